@@ -0,0 +1,434 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads pulling jobs off a shared queue
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threads = 0) : stopping(false), loopHelpers(0), loopActive(0)
+    {
+        loop.next = 0;
+        loop.done = 0;
+        loop.count = 0;
+        loop.body = nullptr;
+        loop.context = nullptr;
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        if (threads == 0)
+            threads = 1;
+        for (unsigned int i = 0; i < threads; ++i)
+            workers.push_back(std::thread(&ThreadPool::run, this));
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    unsigned int size() const { return (unsigned int)workers.size(); }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // Runs body(0..count-1) across the workers and the calling thread, returning
+    // when all are done. Nothing is allocated: the loop state belongs to the pool,
+    // the body is called through a plain function pointer to the caller's functor,
+    // and idle workers join in without a job being queued. One parallelFor at a
+    // time per pool, from whichever thread owns it.
+    template <typename Body>
+    void parallelFor(unsigned int count, const Body& body)
+    {
+        if (count == 0)
+            return;
+        if (count == 1)
+        {
+            body(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loop.next = 0;
+            loop.done = 0;
+            loop.count = count;
+            loop.body = &callBody<Body>;
+            loop.context = &body;
+            loopHelpers = std::min(size(), count - 1);
+        }
+        wake.notify_all();
+        runFor();
+        // workers that have not picked the loop up yet are not needed any more; the
+        // ones inside runFor() must be out of it before body goes out of scope
+        std::unique_lock<std::mutex> lock(mutex);
+        loopHelpers = 0;
+        loopFinished.wait(lock, [this] { return loopActive == 0 && loop.done.load() == loop.count; });
+    }
+
+private:
+    // what the workers and the calling thread share for one parallelFor
+    struct ForJobs
+    {
+        std::atomic<unsigned int> next;
+        std::atomic<unsigned int> done;
+        unsigned int count;
+        void (*body)(const void* context, unsigned int i);
+        const void* context;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    ForJobs loop;
+    unsigned int loopHelpers; // workers still wanted for the current loop
+    unsigned int loopActive; // workers inside runFor()
+    std::condition_variable loopFinished;
+
+    template <typename Body>
+    static void callBody(const void* context, unsigned int i)
+    {
+        (*static_cast<const Body*>(context))(i);
+    }
+
+    void runFor()
+    {
+        for (;;)
+        {
+            unsigned int i = loop.next++;
+            if (i >= loop.count)
+                return;
+            loop.body(loop.context, i);
+            ++loop.done;
+        }
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || loopHelpers > 0 || !jobs.empty(); });
+                if (loopHelpers > 0)
+                {
+                    --loopHelpers;
+                    ++loopActive;
+                }
+                else if (jobs.empty())
+                    return;
+                else
+                {
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+            }
+            if (job)
+            {
+                job();
+                continue;
+            }
+            runFor();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --loopActive;
+            }
+            loopFinished.notify_all();
+        }
+    }
+};
+
+// A ThreadPool made by the first parallelFor() with work to share, so a global
+// owner starts no threads. threads = 0 picks one worker per core besides the
+// calling thread; with no workers the body runs inline.
+class LazyThreadPool
+{
+public:
+    explicit LazyThreadPool(unsigned int threads = 0) : threads(threads) {}
+
+    unsigned int workers() const { return pool ? pool->size() : 0; }
+
+    // runs body(0..count-1) across the pool and the calling thread, returning when all are done
+    template <typename Body>
+    void parallelFor(unsigned int count, const Body& body)
+    {
+        if (count == 0)
+            return;
+        if (!pool && count > 1)
+        {
+            unsigned int workerCount = threads;
+            if (workerCount == 0)
+                workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+            if (workerCount > 0)
+                pool.reset(new ThreadPool(workerCount));
+        }
+        if (!pool)
+        {
+            for (unsigned int c = 0; c < count; ++c)
+                body(c);
+            return;
+        }
+        pool->parallelFor(count, body);
+    }
+
+private:
+    unsigned int threads;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+// 8-bit image decoded on a worker, waiting for its GL upload
+struct DecodedImage
+{
+    int width = 0, height = 0, channels = 0;
+    std::vector<unsigned char> pixels;
+    uint64_t hash = 0; // of the size and pixels, so equal images share one texture
+
+    bool ok() const { return !pixels.empty(); }
+};
+
+inline bool decodeImage(const std::string& path, DecodedImage& image, int forceChannels = 0)
+{
+    unsigned char* data = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, forceChannels);
+    if (!data)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return false;
+    }
+    if (forceChannels != 0)
+        image.channels = forceChannels;
+    image.pixels.assign(data, data + (size_t)image.width * image.height * image.channels);
+    stbi_image_free(data);
+
+    // FNV-1a, hashed here on the worker rather than on the context thread
+    uint64_t h = 14695981039346656037ull;
+    const int header[3] = { image.width, image.height, image.channels };
+    for (size_t i = 0; i < sizeof(header); ++i)
+        h = (h ^ ((const unsigned char*)header)[i]) * 1099511628211ull;
+    for (unsigned char byte : image.pixels)
+        h = (h ^ byte) * 1099511628211ull;
+    image.hash = h;
+    return true;
+}
+
+// a model whose mesh data and textures are ready for upload
+struct LoadedModel
+{
+    unsigned int id;
+    bool ok;
+    bool cacheHit;
+    ModelData data;
+    std::map<std::string, DecodedImage> images; // keyed by the mesh texture paths
+};
+
+// one image destined for an existing texture target, e.g. a cubemap face
+struct LoadedImage
+{
+    unsigned int texture;
+    GLenum target;
+    DecodedImage image;
+};
+
+// Parses meshes and decodes images on a thread pool. Nothing here touches GL:
+// the context thread collects finished assets with takeModel()/takeImage() and
+// uploads them itself, so frames can keep rendering placeholders meanwhile.
+class AssetLoader
+{
+public:
+    explicit AssetLoader(unsigned int threads = 0) : pending(0), pool(threads) {}
+
+    unsigned int threads() const { return pool.size(); }
+    unsigned int remaining() const { return pending.load(); }
+
+    void loadModel(unsigned int id, const std::string& path)
+    {
+        ++pending;
+        pool.submit([this, id, path] {
+            LoadedModel* loaded = new LoadedModel();
+            loaded->id = id;
+            loaded->cacheHit = false;
+            loaded->ok = loadModelData(path, loaded->data, &loaded->cacheHit);
+            if (loaded->ok)
+                for (const MeshData& mesh : loaded->data.meshes)
+                    for (const std::string& texture : mesh.textures)
+                        if (loaded->images.find(texture) == loaded->images.end())
+                            decodeImage(loaded->data.directory + '/' + texture, loaded->images[texture]);
+            finish(models, loaded);
+        });
+    }
+
+    void loadImage(unsigned int texture, GLenum target, const std::string& path, int forceChannels = 0)
+    {
+        ++pending;
+        pool.submit([this, texture, target, path, forceChannels] {
+            LoadedImage* loaded = new LoadedImage();
+            loaded->texture = texture;
+            loaded->target = target;
+            decodeImage(path, loaded->image, forceChannels);
+            finish(images, loaded);
+        });
+    }
+
+    // pops one finished asset; the caller owns the result
+    bool takeModel(LoadedModel& out) { return take(models, out); }
+    bool takeImage(LoadedImage& out) { return take(images, out); }
+
+    // blocks until every submitted job has finished decoding
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending.load() == 0; });
+    }
+
+private:
+    std::atomic<unsigned int> pending;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::deque<LoadedModel*> models;
+    std::deque<LoadedImage*> images;
+    ThreadPool pool; // last, so workers are joined before the queues go away
+
+    template <typename T>
+    void finish(std::deque<T*>& queue, T* item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(item);
+            --pending;
+        }
+        done.notify_all();
+    }
+
+    template <typename T>
+    bool take(std::deque<T*>& queue, T& out)
+    {
+        T* item;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty())
+                return false;
+            item = queue.front();
+            queue.pop_front();
+        }
+        out = std::move(*item);
+        delete item;
+        return true;
+    }
+};
+
+// 1x1 mid-grey 2D texture bound in place of images that are missing or still loading
+inline unsigned int createPlaceholderTexture()
+{
+    const unsigned char grey[3] = { 128, 128, 128 };
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+// Streams decoded pixels to GL through a pixel unpack buffer. The buffer is
+// orphaned before each write, so the copy into it never waits on an earlier
+// upload and glTexImage2D sources from GPU-visible memory.
+class TextureUploader
+{
+public:
+    TextureUploader() : pbo(0) {}
+
+    // 2D texture with the same format and sampling as learnopengl's TextureFromFile
+    unsigned int upload2D(const DecodedImage& image)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GLenum format = formatOf(image.channels);
+        uploadPixels(GL_TEXTURE_2D, format, format, image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return texture;
+    }
+
+    // replaces one face (or level-0 image) of an existing texture
+    void uploadTarget(unsigned int texture, GLenum target, GLenum bindTarget, const DecodedImage& image)
+    {
+        glBindTexture(bindTarget, texture);
+        GLenum format = formatOf(image.channels);
+        uploadPixels(target, format, format, image);
+    }
+
+private:
+    unsigned int pbo;
+
+    static GLenum formatOf(int channels)
+    {
+        return channels == 1 ? GL_RED : channels == 4 ? GL_RGBA : GL_RGB;
+    }
+
+    void uploadPixels(GLenum target, GLenum internalFormat, GLenum format, const DecodedImage& image)
+    {
+        if (pbo == 0)
+            glGenBuffers(1, &pbo);
+        size_t size = image.pixels.size();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        const void* source = NULL; // offset 0 into the PBO
+        if (mapped)
+        {
+            memcpy(mapped, image.pixels.data(), size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            source = image.pixels.data();
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(target, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, source);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+};
+
+#endif
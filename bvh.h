@@ -0,0 +1,143 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "culling.h"
+
+#include <algorithm>
+#include <vector>
+
+// Bounding volume hierarchy over the scene's world-space AABBs.
+// Built top-down with median splits on the longest centroid axis. When objects
+// move it is refit bottom-up instead of rebuilt; build() again only when
+// objects are added or removed.
+class SceneBVH
+{
+public:
+    static const unsigned int LEAF_SIZE = 4;
+
+    struct Node
+    {
+        AABB bounds;
+        unsigned int left, right; // children, interior nodes only
+        unsigned int first, count; // range in items, leaves only (count > 0)
+    };
+
+    unsigned int size() const { return (unsigned int)items.size(); }
+
+    void build(const std::vector<AABB>& boxes)
+    {
+        nodes.clear();
+        items.resize(boxes.size());
+        for (unsigned int i = 0; i < items.size(); ++i)
+            items[i] = i;
+        if (items.empty())
+            return;
+        nodes.reserve(2 * items.size());
+        buildNode(boxes, 0, (unsigned int)items.size());
+    }
+
+    // children are always stored after their parent, so a reverse sweep refits bottom-up
+    void refit(const std::vector<AABB>& boxes)
+    {
+        for (size_t n = nodes.size(); n-- > 0;)
+        {
+            Node& node = nodes[n];
+            node.bounds = AABB();
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                    node.bounds.expand(boxes[items[i]]);
+            }
+            else
+            {
+                node.bounds.expand(nodes[node.left].bounds);
+                node.bounds.expand(nodes[node.right].bounds);
+            }
+        }
+    }
+
+    // appends the ids of every object whose box is inside or touching the frustum;
+    // subtrees entirely inside are accepted without testing their children
+    void cull(const Frustum& frustum, const std::vector<AABB>& boxes, std::vector<unsigned int>& visible) const
+    {
+        if (nodes.empty())
+            return;
+        unsigned int stack[64];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            Frustum::Result result = frustum.classify(node.bounds);
+            if (result == Frustum::OUTSIDE)
+                continue;
+            if (result == Frustum::INSIDE)
+            {
+                appendSubtree(node, visible);
+                continue;
+            }
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                    if (frustum.intersects(boxes[items[i]]))
+                        visible.push_back(items[i]);
+                continue;
+            }
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+    }
+
+private:
+    std::vector<Node> nodes;
+    std::vector<unsigned int> items;
+
+    unsigned int buildNode(const std::vector<AABB>& boxes, unsigned int first, unsigned int count)
+    {
+        unsigned int index = (unsigned int)nodes.size();
+        nodes.push_back(Node());
+
+        AABB bounds, centroids;
+        for (unsigned int i = first; i < first + count; ++i)
+        {
+            bounds.expand(boxes[items[i]]);
+            centroids.expand(boxes[items[i]].center());
+        }
+        nodes[index].bounds = bounds;
+
+        glm::vec3 size = centroids.max - centroids.min;
+        if (count <= LEAF_SIZE || (size.x <= 0.0f && size.y <= 0.0f && size.z <= 0.0f))
+        {
+            nodes[index].first = first;
+            nodes[index].count = count;
+            nodes[index].left = nodes[index].right = 0;
+            return index;
+        }
+
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        unsigned int half = count / 2;
+        std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+            [&boxes, axis](unsigned int a, unsigned int b) { return boxes[a].center()[axis] < boxes[b].center()[axis]; });
+
+        unsigned int left = buildNode(boxes, first, half);
+        unsigned int right = buildNode(boxes, first + half, count - half);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        nodes[index].first = 0;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    void appendSubtree(const Node& node, std::vector<unsigned int>& visible) const
+    {
+        if (node.count > 0)
+        {
+            visible.insert(visible.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+            return;
+        }
+        appendSubtree(nodes[node.left], visible);
+        appendSubtree(nodes[node.right], visible);
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "asset_loader.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// a floodlight; its contribution falls smoothly to zero at radius
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color; // already scaled by intensity
+    int shadowSlot;  // group of six tiles in the shadow atlas, -1 when unshadowed
+};
+
+// Cluster grid: screen tiles times depth slices spaced exponentially between the
+// near and far planes. The CLUSTERED_LIGHTS block of mainFrag.frag uses the same numbers.
+const unsigned int CLUSTER_X = 16, CLUSTER_Y = 9, CLUSTER_Z = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+const unsigned int MAX_CLUSTERED_LIGHTS = 65535; // indices are 16-bit
+
+// Bins point lights into view-space clusters every frame so the main pass only
+// loops over the lights that reach a fragment's cluster. Each light's sphere is
+// bounded in view space once (tile columns and rows from the planes through the
+// tile edges, slices from its depth range), then every depth slice is filled by
+// its own job on the worker threads, writing only its own clusters. The results
+// go to the GPU as three buffer textures:
+//   lights   RGBA32F, two texels per light: position, radius | colour, shadow slot
+//   clusters RG32UI,  first index and light count per cluster
+//   indices  R16UI,   the light lists of all clusters back to back
+class LightClusters
+{
+public:
+    unsigned int lightTexture, clusterTexture, indexTexture;
+    float depthScale, depthBias; // slice = floor(log(view depth) * depthScale + depthBias)
+
+    // of the last build()
+    unsigned int references; // light indices over all clusters
+    unsigned int maxPerCluster;
+
+    // threads = 0 picks one worker per core besides the calling thread
+    explicit LightClusters(unsigned int threads = 0)
+        : lightTexture(0), clusterTexture(0), indexTexture(0), depthScale(0.0f), depthBias(0.0f),
+          references(0), maxPerCluster(0), pool(threads), lightBuffer(0), clusterBuffer(0), indexBuffer(0) {}
+
+    // bins the lights for a symmetric perspective view; fovY in radians
+    void build(const std::vector<PointLight>& lights, const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane)
+    {
+        unsigned int lightCount = (unsigned int)std::min<size_t>(lights.size(), MAX_CLUSTERED_LIGHTS);
+        float logRange = std::log(farPlane / nearPlane);
+        depthScale = CLUSTER_Z / logRange;
+        depthBias = -CLUSTER_Z * std::log(nearPlane) / logRange;
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+
+        // view-space bounds of every light, in chunks across the workers
+        bounds.resize(lightCount);
+        const unsigned int chunk = 256;
+        pool.parallelFor((lightCount + chunk - 1) / chunk, [&](unsigned int c)
+        {
+            unsigned int end = std::min(lightCount, (c + 1) * chunk);
+            for (unsigned int i = c * chunk; i < end; ++i)
+                bounds[i] = bound(lights[i], view, tanX, tanY, nearPlane, farPlane);
+        });
+
+        // one job per depth slice: count, then fill the slice's clusters
+        sliceIndices.resize(CLUSTER_Z);
+        ranges.resize(CLUSTER_COUNT * 2);
+        pool.parallelFor(CLUSTER_Z, [&](unsigned int z)
+        {
+            const unsigned int sliceClusters = CLUSTER_X * CLUSTER_Y;
+            uint32_t* range = &ranges[z * sliceClusters * 2];
+            for (unsigned int c = 0; c < sliceClusters; ++c)
+                range[c * 2 + 1] = 0;
+            for (unsigned int i = 0; i < lightCount; ++i)
+            {
+                const LightBounds& b = bounds[i];
+                if (!b.visible || z < b.z0 || z > b.z1)
+                    continue;
+                for (unsigned int y = b.y0; y <= b.y1; ++y)
+                    for (unsigned int x = b.x0; x <= b.x1; ++x)
+                        ++range[(y * CLUSTER_X + x) * 2 + 1];
+            }
+            uint32_t offset = 0;
+            for (unsigned int c = 0; c < sliceClusters; ++c)
+            {
+                range[c * 2] = offset;
+                offset += range[c * 2 + 1];
+            }
+            std::vector<uint16_t>& list = sliceIndices[z];
+            list.resize(offset);
+            for (unsigned int c = 0; c < sliceClusters; ++c)
+                range[c * 2 + 1] = 0; // reused as the fill cursor
+            for (unsigned int i = 0; i < lightCount; ++i)
+            {
+                const LightBounds& b = bounds[i];
+                if (!b.visible || z < b.z0 || z > b.z1)
+                    continue;
+                for (unsigned int y = b.y0; y <= b.y1; ++y)
+                    for (unsigned int x = b.x0; x <= b.x1; ++x)
+                    {
+                        uint32_t* r = &range[(y * CLUSTER_X + x) * 2];
+                        list[r[0] + r[1]++] = (uint16_t)i;
+                    }
+            }
+        });
+
+        // slices were filled independently; rebase their offsets onto one list
+        indices.clear();
+        maxPerCluster = 0;
+        for (unsigned int z = 0; z < CLUSTER_Z; ++z)
+        {
+            uint32_t base = (uint32_t)indices.size();
+            for (unsigned int c = z * CLUSTER_X * CLUSTER_Y; c < (z + 1) * CLUSTER_X * CLUSTER_Y; ++c)
+            {
+                ranges[c * 2] += base;
+                maxPerCluster = std::max(maxPerCluster, ranges[c * 2 + 1]);
+            }
+            indices.insert(indices.end(), sliceIndices[z].begin(), sliceIndices[z].end());
+        }
+        references = (unsigned int)indices.size();
+
+        lightData.resize(std::max(1u, lightCount) * 2);
+        for (unsigned int i = 0; i < lightCount; ++i)
+        {
+            lightData[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+            lightData[i * 2 + 1] = glm::vec4(lights[i].color, (float)lights[i].shadowSlot);
+        }
+        if (indices.empty())
+            indices.push_back(0); // a buffer texture needs some storage
+        upload();
+    }
+
+    // binds the three buffer textures for mainFrag.frag's CLUSTERED_LIGHTS block
+    void bindTextures(unsigned int lightUnit, unsigned int clusterUnit, unsigned int indexUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + lightUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glActiveTexture(GL_TEXTURE0 + clusterUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+        glActiveTexture(GL_TEXTURE0 + indexUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glActiveTexture(GL_TEXTURE0);
+        renderStats().textureBinds += 3;
+    }
+
+private:
+    // cluster ranges touched by one light, inclusive
+    struct LightBounds
+    {
+        bool visible;
+        unsigned char x0, x1, y0, y1, z0, z1;
+    };
+
+    LazyThreadPool pool;
+    std::vector<LightBounds> bounds;
+    std::vector<std::vector<uint16_t>> sliceIndices;
+    std::vector<uint32_t> ranges; // first, count per cluster
+    std::vector<uint16_t> indices;
+    std::vector<glm::vec4> lightData;
+    unsigned int lightBuffer, clusterBuffer, indexBuffer;
+
+    LightBounds bound(const PointLight& light, const glm::mat4& view, float tanX, float tanY, float nearPlane, float farPlane) const
+    {
+        LightBounds b = {};
+        glm::vec3 c = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        float r = light.radius;
+        float depth = -c.z;
+        if (depth + r < nearPlane || depth - r > farPlane)
+            return b;
+        b.z0 = (unsigned char)slice(std::max(depth - r, nearPlane));
+        b.z1 = (unsigned char)slice(std::min(depth + r, farPlane));
+
+        // tile edge k sits at NDC -1 + 2k/N; the plane through it and the eye is
+        // x + a * tanX * z = 0, with positive distances to its right
+        int x0, x1, y0, y1;
+        if (!tileRange(c.x, c.z, r, tanX, CLUSTER_X, x0, x1) || !tileRange(c.y, c.z, r, tanY, CLUSTER_Y, y0, y1))
+            return b;
+        b.x0 = (unsigned char)x0;
+        b.x1 = (unsigned char)x1;
+        b.y0 = (unsigned char)y0;
+        b.y1 = (unsigned char)y1;
+        b.visible = true;
+        return b;
+    }
+
+    static bool tileRange(float p, float z, float r, float tanHalf, unsigned int tiles, int& first, int& last)
+    {
+        first = -1;
+        last = -1;
+        for (unsigned int k = 0; k < tiles; ++k)
+        {
+            float left = distance(p, z, (-1.0f + 2.0f * k / tiles) * tanHalf);
+            float right = distance(p, z, (-1.0f + 2.0f * (k + 1) / tiles) * tanHalf);
+            if (left > -r && right < r)
+            {
+                if (first < 0)
+                    first = (int)k;
+                last = (int)k;
+            }
+        }
+        return first >= 0;
+    }
+
+    static float distance(float p, float z, float slope)
+    {
+        return (p + slope * z) / std::sqrt(1.0f + slope * slope);
+    }
+
+    int slice(float depth) const
+    {
+        int s = (int)std::floor(std::log(depth) * depthScale + depthBias);
+        return std::max(0, std::min((int)CLUSTER_Z - 1, s));
+    }
+
+    void upload()
+    {
+        if (lightTexture == 0)
+        {
+            lightTexture = createBufferTexture(lightBuffer, GL_RGBA32F);
+            clusterTexture = createBufferTexture(clusterBuffer, GL_RG32UI);
+            indexTexture = createBufferTexture(indexBuffer, GL_R16UI);
+        }
+        // orphan and rewrite, like UniformBlock::update()
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, ranges.size() * sizeof(uint32_t), ranges.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    static unsigned int createBufferTexture(unsigned int& buffer, GLenum format)
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return texture;
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+// axis-aligned bounding box
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+    AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+    bool empty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+    void expand(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void expand(const AABB& box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    // bounds of this box after an affine transform (Arvo's method)
+    AABB transformed(const glm::mat4& m) const
+    {
+        if (empty())
+            return *this;
+        glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+        glm::vec3 e = extent();
+        glm::vec3 r(
+            glm::abs(m[0][0]) * e.x + glm::abs(m[1][0]) * e.y + glm::abs(m[2][0]) * e.z,
+            glm::abs(m[0][1]) * e.x + glm::abs(m[1][1]) * e.y + glm::abs(m[2][1]) * e.z,
+            glm::abs(m[0][2]) * e.x + glm::abs(m[1][2]) * e.y + glm::abs(m[2][2]) * e.z);
+        return AABB(c - r, c + r);
+    }
+};
+
+// six clip planes of a view-projection matrix, normals pointing inwards
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        // Gribb/Hartmann: planes are sums/differences of the matrix rows
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[0] = row3 + row0; // left
+        planes[1] = row3 - row0; // right
+        planes[2] = row3 + row1; // bottom
+        planes[3] = row3 - row1; // top
+        planes[4] = row3 + row2; // near
+        planes[5] = row3 - row2; // far
+    }
+
+    enum Result { OUTSIDE, INTERSECTS, INSIDE };
+
+    // conservative: OUTSIDE only when the box is entirely behind one plane
+    Result classify(const AABB& box) const
+    {
+        glm::vec3 c = box.center();
+        glm::vec3 e = box.extent();
+        Result result = INSIDE;
+        for (int i = 0; i < 6; ++i)
+        {
+            glm::vec3 n(planes[i]);
+            float r = e.x * glm::abs(n.x) + e.y * glm::abs(n.y) + e.z * glm::abs(n.z);
+            float d = glm::dot(n, c) + planes[i].w;
+            if (d < -r)
+                return OUTSIDE;
+            if (d < r)
+                result = INTERSECTS;
+        }
+        return result;
+    }
+
+    bool intersects(const AABB& box) const { return classify(box) != OUTSIDE; }
+};
+
+#endif
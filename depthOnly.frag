@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth pre-pass: the depth write is all that is needed
+void main()
+{
+}
@@ -0,0 +1,141 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Linear allocator for data that only lives until the end of the frame.
+// allocate() bumps an offset into one block and reset(), at the top of the
+// next frame, hands the whole block back at once; nothing is freed on its own
+// and no destructors run, so it holds plain data and ArenaAllocator containers
+// that are locals of the frame. A frame that needs more than the block spills
+// to the heap (and shows up in the heap allocation count); the following
+// reset() grows the block past that frame's total, so the arena stops
+// spilling once it has seen the biggest frame.
+class FrameArena
+{
+public:
+    size_t highWater; // most bytes any frame has asked for
+    unsigned long long spills; // allocations that did not fit and went to the heap
+
+    explicit FrameArena(size_t capacity = 64 * 1024) : highWater(0), spills(0), block(nullptr), capacity(0), used(0)
+    {
+        allocateBlock(capacity);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    ~FrameArena()
+    {
+        releaseSpilled();
+        std::free(block);
+    }
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        // aligned by address, since the block itself is only malloc-aligned
+        uintptr_t base = reinterpret_cast<uintptr_t>(block);
+        size_t start = (size_t)(((base + used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+        // keep counting past the end, so reset() knows how much the frame wanted
+        used = start + bytes;
+        highWater = std::max(highWater, used);
+        if (used <= capacity)
+            return block + start;
+        ++spills;
+#ifdef __cpp_aligned_new
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            void* p = ::operator new(bytes, std::align_val_t(alignment));
+            spilled.push_back(std::make_pair(p, alignment));
+            return p;
+        }
+#endif
+        void* p = ::operator new(bytes);
+        spilled.push_back(std::make_pair(p, (size_t)0));
+        return p;
+    }
+
+    // uninitialised storage for count objects of T
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // frees everything allocated since the last reset; call between frames
+    void reset()
+    {
+        releaseSpilled();
+        if (highWater > capacity)
+            allocateBlock(highWater + highWater / 2);
+        used = 0;
+    }
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const { return capacity; }
+
+private:
+    unsigned char* block;
+    size_t capacity;
+    size_t used;
+    std::vector<std::pair<void*, size_t>> spilled; // and the alignment it was asked for, 0 for the default
+
+    // replaces the block; throws std::bad_alloc like operator new if malloc fails
+    void allocateBlock(size_t size)
+    {
+        std::free(block);
+        block = static_cast<unsigned char*>(std::malloc(std::max<size_t>(size, 1)));
+        capacity = block ? size : 0;
+        if (!block)
+            throw std::bad_alloc();
+    }
+
+    void releaseSpilled()
+    {
+        for (const std::pair<void*, size_t>& p : spilled)
+        {
+#ifdef __cpp_aligned_new
+            if (p.second != 0)
+            {
+                ::operator delete(p.first, std::align_val_t(p.second));
+                continue;
+            }
+#endif
+            ::operator delete(p.first);
+        }
+        spilled.clear();
+    }
+};
+
+// STL allocator over a FrameArena, for containers that are built and thrown
+// away within one frame; deallocate() is a no-op, the arena's reset() frees
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return arena->allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) out vec4 gPosition;
+layout (location = 1) out vec4 gNormal;
+layout (location = 2) out vec4 gAlbedo;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} fs_in;
+
+uniform sampler2D diffuseTexture;
+
+// geometry pass of the deferred path: store what the lighting pass needs, no lighting here
+void main()
+{
+    gPosition = vec4(fs_in.FragPos, 1.0);
+    gNormal = vec4(normalize(fs_in.Normal), 0.0);
+    gAlbedo = vec4(texture(diffuseTexture, fs_in.TexCoords).rgb, 1.0);
+}
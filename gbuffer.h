@@ -0,0 +1,106 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include "trace.h"
+
+#include <iostream>
+
+// how the main pass shades the scene
+enum RenderPath { PATH_FORWARD, PATH_PREPASS, PATH_DEFERRED, PATH_COUNT };
+
+inline const char* renderPathName(int path)
+{
+    static const char* names[PATH_COUNT] = { "forward", "prepass", "deferred" };
+    return names[path];
+}
+
+// Geometry buffer for the deferred path: world position, normal and albedo
+// targets plus a depth/stencil renderbuffer in the same format as the window's,
+// so the depth can be blitted back for the skybox.
+class GBuffer
+{
+public:
+    unsigned int fbo;
+    unsigned int position; // RGBA16F world-space position
+    unsigned int normal;   // RGBA16F world-space unit normal
+    unsigned int albedo;   // RGBA8, alpha 0 where nothing was drawn
+    unsigned int depth;
+    unsigned int width, height;
+
+    GBuffer(unsigned int width, unsigned int height) : width(width), height(height)
+    {
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        position = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT, 0);
+        normal = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT, 1);
+        albedo = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 2);
+        const GLenum attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, attachments);
+
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "G-buffer framebuffer is not complete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // reallocates every target at the new size, e.g. when the render resolution changes
+    void resize(unsigned int w, unsigned int h)
+    {
+        if (w == width && h == height)
+            return;
+        width = w;
+        height = h;
+        allocate(position, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        allocate(normal, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        allocate(albedo, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    }
+
+    // binds the targets for sampling on three texture units
+    void bindTextures(unsigned int positionUnit, unsigned int normalUnit, unsigned int albedoUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + positionUnit);
+        glBindTexture(GL_TEXTURE_2D, position);
+        glActiveTexture(GL_TEXTURE0 + normalUnit);
+        glBindTexture(GL_TEXTURE_2D, normal);
+        glActiveTexture(GL_TEXTURE0 + albedoUnit);
+        glBindTexture(GL_TEXTURE_2D, albedo);
+        glActiveTexture(GL_TEXTURE0);
+        renderStats().textureBinds += 3;
+    }
+
+    // copies the G-buffer depth into target (0 = default framebuffer) and leaves target bound
+    void blitDepth(unsigned int target) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+private:
+    unsigned int createTarget(GLenum internalFormat, GLenum format, GLenum type, unsigned int attachment)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        allocate(texture, internalFormat, format, type);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, GL_TEXTURE_2D, texture, 0);
+        return texture;
+    }
+
+    void allocate(unsigned int texture, GLenum internalFormat, GLenum format, GLenum type)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    }
+};
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef INPUT_REPLAY_H
+#define INPUT_REPLAY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Binary session stream: an 8-byte header, then one record per event, each a
+// type byte and a fixed little payload. Every frame starts with a FRAME record
+// carrying its timestamps; the events after it, up to the next FRAME, are what
+// the frame saw before processInput(). Keys are stored as changes of the
+// polled state, so a held key costs nothing per frame.
+const char INPUT_STREAM_MAGIC[4] = { 'I', 'N', 'P', 'R' };
+const uint32_t INPUT_STREAM_VERSION = 1;
+
+enum InputEventType : uint8_t
+{
+    INPUT_FRAME,  // float deltaTime, double simulation time
+    INPUT_KEY,    // uint16 GLFW key, uint8 down
+    INPUT_CURSOR, // float x, y in window coordinates
+    INPUT_SCROLL, // float x, y offsets
+    INPUT_SEED    // uint32 race seed, uint32 car count
+};
+
+struct InputEvent
+{
+    InputEventType type;
+    int key;
+    bool down;
+    float x, y; // cursor position or scroll offsets; x is the delta time of a FRAME
+    double time; // simulation time of a FRAME
+    uint32_t seed, cars;
+};
+
+// the record payload sizes, indexed by InputEventType
+inline size_t inputPayloadSize(uint8_t type)
+{
+    static const size_t sizes[] = { sizeof(float) + sizeof(double), sizeof(uint16_t) + 1, 2 * sizeof(float), 2 * sizeof(float), 2 * sizeof(uint32_t) };
+    return type < sizeof(sizes) / sizeof(sizes[0]) ? sizes[type] : 0;
+}
+
+// Writes a session while the app runs. Cursor and scroll callbacks arrive during
+// glfwPollEvents() at the end of a frame, so they are held back and written
+// after the next frame's FRAME record, where the replay applies them.
+class InputRecorder
+{
+public:
+    static const int MAX_KEYS = 512; // above GLFW_KEY_LAST
+
+    InputRecorder() : file(NULL), frames(0) { memset(keys, 0, sizeof(keys)); }
+    ~InputRecorder() { close(); }
+
+    bool active() const { return file != NULL; }
+
+    bool open(const std::string& path, uint32_t seed, unsigned int cars)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        fwrite(INPUT_STREAM_MAGIC, 1, 4, file);
+        fwrite(&INPUT_STREAM_VERSION, sizeof(INPUT_STREAM_VERSION), 1, file);
+        uint32_t payload[2] = { seed, cars };
+        write(INPUT_SEED, payload, sizeof(payload));
+        return true;
+    }
+
+    // starts a frame; call before the frame reads any input
+    void frame(float deltaTime, double simTime)
+    {
+        if (!file)
+            return;
+        unsigned char payload[sizeof(float) + sizeof(double)];
+        memcpy(payload, &deltaTime, sizeof(float));
+        memcpy(payload + sizeof(float), &simTime, sizeof(double));
+        write(INPUT_FRAME, payload, sizeof(payload));
+        if (!pending.empty())
+            fwrite(pending.data(), 1, pending.size(), file);
+        pending.clear();
+        ++frames;
+    }
+
+    // the polled state of a key; only changes are written
+    void key(int key, bool down)
+    {
+        if (!file || key < 0 || key >= MAX_KEYS || keys[key] == down)
+            return;
+        keys[key] = down;
+        unsigned char payload[3];
+        uint16_t code = (uint16_t)key;
+        memcpy(payload, &code, sizeof(code));
+        payload[2] = down ? 1 : 0;
+        write(INPUT_KEY, payload, sizeof(payload));
+    }
+
+    void cursor(double x, double y) { hold(INPUT_CURSOR, (float)x, (float)y); }
+    void scroll(double x, double y) { hold(INPUT_SCROLL, (float)x, (float)y); }
+
+    unsigned int recordedFrames() const { return frames; }
+
+    void close()
+    {
+        if (!file)
+            return;
+        fclose(file);
+        file = NULL;
+    }
+
+private:
+    FILE* file;
+    bool keys[MAX_KEYS];
+    std::vector<unsigned char> pending; // callback events for the next frame
+    unsigned int frames;
+
+    void write(InputEventType type, const void* payload, size_t size)
+    {
+        uint8_t tag = type;
+        fwrite(&tag, 1, 1, file);
+        fwrite(payload, 1, size, file);
+    }
+
+    void hold(InputEventType type, float x, float y)
+    {
+        if (!file)
+            return;
+        pending.push_back(type);
+        size_t at = pending.size();
+        pending.resize(at + 2 * sizeof(float));
+        memcpy(&pending[at], &x, sizeof(float));
+        memcpy(&pending[at + sizeof(float)], &y, sizeof(float));
+    }
+};
+
+// Plays a recorded session back one frame at a time. The whole stream is read
+// up front, so a replay does no file IO while it renders.
+class InputReplay
+{
+public:
+    // the race setup the session was recorded with, from its leading SEED record
+    uint32_t seed;
+    unsigned int cars;
+
+    InputReplay() : seed(1), cars(3), position(0), loaded(false), frameCount(0), played(0) { memset(keys, 0, sizeof(keys)); }
+
+    bool active() const { return loaded; }
+
+    // false if the file is missing, of another version or truncated mid-record
+    bool open(const std::string& path)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        stream.resize(size > 0 ? (size_t)size : 0);
+        bool ok = !stream.empty() && fread(stream.data(), 1, stream.size(), file) == stream.size();
+        fclose(file);
+        uint32_t version = 0;
+        if (!ok || stream.size() < 8 || memcmp(stream.data(), INPUT_STREAM_MAGIC, 4) != 0)
+            return false;
+        memcpy(&version, &stream[4], sizeof(version));
+        if (version != INPUT_STREAM_VERSION)
+            return false;
+
+        // validate every record once, so nextFrame() can trust the stream
+        frameCount = 0;
+        for (size_t at = 8; at < stream.size();)
+        {
+            uint8_t type = stream[at];
+            size_t payload = inputPayloadSize(type);
+            if (payload == 0 || at + 1 + payload > stream.size())
+                return false;
+            frameCount += type == INPUT_FRAME ? 1 : 0;
+            at += 1 + payload;
+        }
+        position = 8;
+        if (position < stream.size() && stream[position] == INPUT_SEED)
+        {
+            InputEvent event = read();
+            seed = event.seed;
+            cars = event.cars;
+        }
+        loaded = true;
+        return true;
+    }
+
+    // Advances to the next frame: returns its timestamps and the events recorded
+    // for it, and updates the key state. False once the session is over.
+    bool nextFrame(float& deltaTime, double& simTime, std::vector<InputEvent>& events)
+    {
+        events.clear();
+        if (!loaded || position >= stream.size() || stream[position] != INPUT_FRAME)
+            return false;
+        InputEvent frame = read();
+        deltaTime = frame.x;
+        simTime = frame.time;
+        while (position < stream.size() && stream[position] != INPUT_FRAME)
+        {
+            InputEvent event = read();
+            if (event.type == INPUT_KEY)
+                keys[event.key] = event.down;
+            else
+                events.push_back(event);
+        }
+        ++played;
+        return true;
+    }
+
+    bool keyDown(int key) const { return key >= 0 && key < InputRecorder::MAX_KEYS && keys[key]; }
+
+    unsigned int frames() const { return frameCount; }
+    unsigned int playedFrames() const { return played; }
+
+private:
+    std::vector<unsigned char> stream;
+    size_t position;
+    bool loaded;
+    bool keys[InputRecorder::MAX_KEYS];
+    unsigned int frameCount;
+    unsigned int played;
+
+    InputEvent read()
+    {
+        InputEvent event = {};
+        event.type = (InputEventType)stream[position++];
+        const unsigned char* payload = &stream[position];
+        switch (event.type)
+        {
+        case INPUT_FRAME:
+            memcpy(&event.x, payload, sizeof(float));
+            memcpy(&event.time, payload + sizeof(float), sizeof(double));
+            break;
+        case INPUT_KEY:
+        {
+            uint16_t code;
+            memcpy(&code, payload, sizeof(code));
+            event.key = code < InputRecorder::MAX_KEYS ? code : 0;
+            event.down = payload[2] != 0;
+            break;
+        }
+        case INPUT_CURSOR:
+        case INPUT_SCROLL:
+            memcpy(&event.x, payload, sizeof(float));
+            memcpy(&event.y, payload + sizeof(float), sizeof(float));
+            break;
+        case INPUT_SEED:
+            memcpy(&event.seed, payload, sizeof(uint32_t));
+            memcpy(&event.cars, payload + sizeof(uint32_t), sizeof(uint32_t));
+            break;
+        }
+        position += inputPayloadSize(event.type);
+        return event;
+    }
+};
+
+// FNV-1a over a frame's pixels, for golden-image comparisons between runs
+inline uint64_t imageChecksum(const unsigned char* pixels, size_t size)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+        h = (h ^ pixels[i]) * 1099511628211ull;
+    return h;
+}
+
+#endif
@@ -6,13 +6,41 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
 
+#include "asset_loader.h"
+#include "bvh.h"
+#include "clustered_lights.h"
+#include "culling.h"
+#include "frame_arena.h"
+#include "gbuffer.h"
+#include "input_replay.h"
+#include "mesh_cache.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "quality_governor.h"
+#include "race_sim.h"
+#include "render_model.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "shader_program.h"
+#include "shadow_atlas.h"
+#include "shadow_cache.h"
+#include "shadow_filter.h"
+#include "texture_cache.h"
+#include "trace.h"
+#include "uniform_blocks.h"
+#include "world_stream.h"
+
+#include <cstring>
 #include <iostream>
-#include <stack>
+#include <map>
+#include <new>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h> // _aligned_malloc
+#endif
 
 using namespace std;
 using namespace glm;
@@ -21,15 +49,76 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
+bool keyDown(GLFWwindow* window, int key);
+void moveCursor(double xpos, double ypos);
+int finishReplay();
+void scriptedCamera(int frame, int frameCount);
+bool createOffscreenTarget(unsigned int width, unsigned int height, unsigned int& fbo, unsigned int& colorRBO, unsigned int& depthRBO);
 unsigned int loadTexture(const char* path);
-void renderScene(Shader& shader, Model& Merc, Model& F1Generic, Model& Road, Model& Grandstand, Model& Renault);
-unsigned int loadCubemap(vector<std::string> faces);
+void buildScene(bool fixedTrack);
+void placeFloodlights(unsigned int count);
+void renderScene(ShaderProgram& shader, bool normals, InstanceSet set = INSTANCES_ALL);
+void renderSceneCulled(ShaderProgram& shader, const Frustum& frustum, const mat4& viewProjection, bool recull = true);
+void cullEntities(const Frustum& frustum, InstanceSet set, vector<unsigned int>& visible);
+template <typename LodOf>
+void cullOccluded(const mat4& viewProjection, vector<unsigned int>& entities, const LodOf& lodOf, const char* objectsCounter, const char* trianglesCounter);
+unsigned int dynamicShadowFaces(const Frustum faces[6]);
+void renderShadowFaces(ShaderProgram& shader, unsigned int cubemap, unsigned int layeredFBO, unsigned int faceMask, const mat4 shadowTransforms[6], vec3 lightPos, InstanceSet set);
+template <typename BindFace>
+void drawShadowFaces(ShaderProgram& shader, const mat4 faceMatrices[6], unsigned int faceMask, vec3 lightPos, float pixelsPerUnit, InstanceSet set, const BindFace& bindFace);
+void renderShadowAtlas(ShaderProgram& shader, ShadowAtlas& atlas, const AtlasBlock& block);
+unsigned int selectLod(unsigned int entity, vec3 eye, float pixelsPerUnit, float bias);
+unsigned int loadCubemap(vector<std::string> faces, AssetLoader& loader);
+unsigned int pumpAssets(AssetLoader& loader, TextureUploader& uploader);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 bool shadows = true;
 bool shadowsKeyPressed = false;
+bool instancing = true;
+bool instancingKeyPressed = false;
+bool shadowCaching = true;
+float shadowCacheThreshold = 0.5f; // light movement that forces a static shadow rebuild
+bool shadowFaceCulling = true; // per-face culled draws instead of geometry shader fan-out
+bool frustumCulling = true; // main pass draws only what the BVH finds in the camera frustum
+bool useRenderQueue = true; // per-object draws go through the sorted render queue
+bool lodEnabled = true; // culled draws pick a simplified mesh LOD per instance
+float lodPixelError = 1.0f; // largest simplification error allowed on screen, in pixels
+float shadowLodBias = 4.0f; // the shadow pass accepts this many times the main pass's error
+bool quantizedVertices = false; // 16-byte QuantizedVertex buffers and the QUANTIZED_VERTICES shader variants
+float shadowPixelsPerUnit = 512.0f; // 90 degree cubemap faces: half the face width
+ShadowFilter shadowFilter = SHADOW_VSM; // PCF is kept as the reference path
+bool shadowFilterKeyPressed = false;
+bool shadowFilterCompare = false; // --shadow-compare: cycle the filters every frame and time each
+RenderPath renderPath = PATH_FORWARD;
+bool renderPathKeyPressed = false;
+unsigned int shadowFaceFBO;
+bool bakeMeshes = false; // --bake-meshes: regenerate the binary mesh caches and exit
+
+// benchmark mode: no window, render into an FBO along a scripted camera path
+bool headless = false;
+int benchmarkFrames = 600;
+int benchmarkWarmup = 60;
+enum RenderPass { PASS_SHADOW, PASS_PREFILTER, PASS_MAIN, PASS_SKYBOX, PASS_MAIN_PCF, PASS_MAIN_VSM, PASS_MAIN_ESM, PASS_ATLAS, PASS_COUNT };
+FrameProfiler profiler({ "shadow", "prefilter", "main", "skybox", "main pcf", "main vsm", "main esm", "shadow atlas" });
+FrameTracer tracer; // --trace FILE: CPU/GPU scopes and counters as Chrome trace JSON
+
+// --frame-budget MS: steps down QUALITY_LEVELS (PCF taps, internal resolution,
+// shadow size) while frames run over budget and back up once there is headroom
+QualityGovernor quality;
+unsigned int outputWidth = SCR_WIDTH, outputHeight = SCR_HEIGHT; // window framebuffer, or the headless FBO
+unsigned int renderWidth = SCR_WIDTH, renderHeight = SCR_HEIGHT; // what the main pass draws at, before the upscale
+
+// --record FILE writes the session's input, --replay FILE feeds one back frame by frame;
+// replays checksum every frame, compared with or written to --golden FILE
+InputRecorder inputRecorder;
+InputReplay inputReplay;
+std::string recordPath;
+std::string goldenPath;
+vector<InputEvent> replayEvents;
+vector<unsigned char> framePixels;
+vector<uint64_t> frameChecksums;
 
 // camera
 Camera camera(glm::vec3(0.0f, 3.0f, 5.0f));
@@ -45,54 +134,418 @@ float lastFrame = 0.0f;
 //Lighting Stuff
 vec3 lightStrength = vec3(0.7f);
 
-//Animation Stuff (But not really this is actually positioning stuff)
-float F1GenericGoX = -1.3f, F1GenericGoY = 0.0f, F1GenericGoZ = 0.0f;
-float RenaultGoX = 1.4f, RenaultGoY = 0.4f, RenaultGoZ = -5.0f;
-float MercGoX = -1.4f, MercGoY = 0.4f, MercGoZ = -10.2f;
+// every placed object, and the entities the race animation moves
+enum ModelId { MODEL_F1GENERIC, MODEL_RENAULT, MODEL_MERC, MODEL_ROAD, MODEL_GRANDSTAND, MODEL_COUNT };
+const char* modelPaths[MODEL_COUNT] = {
+    "Glitter/Sources/F1Generic/untitled.obj",
+    "Glitter/Sources/Renault/untitled.obj",
+    "Glitter/Sources/Merc/untitled.obj",
+    "Glitter/Sources/Road/untitled.obj",
+    "Glitter/Sources/Grandstand/untitled.obj"
+};
+// car i is drawn with model carModels[i % 3], raised and scaled to sit on the road
+const ModelId carModels[3] = { MODEL_F1GENERIC, MODEL_RENAULT, MODEL_MERC };
+const float carHeight[3] = { 0.0f, 0.4f, 0.4f };
+const float carScale[3] = { 1.0f, 0.7f, 0.7f };
+// the car bodies and grandstands hide what is behind them; the flat road hides nothing
+const bool modelOccludes[MODEL_COUNT] = { true, true, true, false, true };
+vector<RenderModel> models; // indexed by ModelId, empty until the loader delivers each one
+unsigned int placeholderTexture; // stands in for textures that failed to decode
+unsigned int modelsLoaded = 0;
+unsigned int meshCacheHits = 0;
+float assetLoadStart = 0.0f;
+SceneTable scene;
+SceneBVH sceneBVH;
+vector<unsigned int> visibleEntities; // scratch list for culling queries
+vector<unsigned int> queueEntities; // scratch list of the entities of one InstanceSet
+vector<unsigned char> entityLod; // LOD picked for each entity in the current view
+RenderQueue renderQueue;
+vector<unsigned int> carEntities; // scene entity of each simulated car
+vector<float> carZ; // interpolated car positions for the frame being drawn
+
+// --track FILE streams the road and grandstands in tiles around the camera
+// instead of placing the fixed three-segment track up front
+std::string trackPath;
+WorldStreamer worldStreamer;
+
+// --lights N adds N floodlights, shaded through the light clusters; the
+// --shadowed-lights most important of them get faces in the shadow atlas
+unsigned int floodlightCount = 0;
+unsigned int shadowedLights = 4;
+vector<PointLight> floodlights;
+LightClusters lightClusters;
+
+// Hi-Z occlusion: the occluders in view are rasterized on the CPU and what they
+// hide is not drawn; --no-occlusion or O turns it off
+bool occlusionCulling = true;
+bool occlusionKeyPressed = false;
+vector<OccluderMesh> occluderMeshes; // by ModelId, empty for models that hide nothing
+OcclusionBuffer occlusionBuffer;
+
+// per-frame temporaries, all handed back at the top of the next frame;
+// --zero-alloc fails a headless run if any steady frame still uses the heap
+FrameArena frameArena;
+bool zeroAllocCheck = false;
 
 //Actual Animation Stuff
-int Icar1 = rand() % 70 + 30;
-int Icar2 = rand() % 70 + 30;
-int Icar3 = rand() % Icar1 + 30;
-float car1 = static_cast<float>(Icar1) / 1000;
-float car2 = static_cast<float>(Icar2) / 1000;
-float car3 = static_cast<float>(Icar3) / 1000;
-
-int main()
-{
-    cout << "MOVEMENT CONTROLS" << endl;
-    cout << "The controls are set up like a 'fly camera'" << endl;
-    cout << "So, use the mouse to look around, and the WASD to move!" << endl;
-    cout << "W: Moves Forward" << endl;
-    cout << "S: Moves Backward" << endl;
-    cout << "A: Strafes Left" << endl;
-    cout << "D: Strafes Right" << endl;
-    cout << "LEFT SHIFT: Engages 'Sprint Move' while held done" << endl;
-    cout << "" << endl;
-    
-    cout << "ANIMATION CONTROLS" << endl;
-    cout << "This scene simulates the most crucial stages of an F1 Race Start - Getting of the line" << endl;
-    cout << "Pressing and holding the 'UP' arrow key gets the cars off the line and allows you to watch the start" << endl;
-    cout << "Pressing 'R' resets the cars to the starting postion" << endl;
-    cout << "Each subsequent race start is always different!" << endl;
-    cout << "" << endl;
+// fixed 60 Hz ticks, on their own thread unless --no-sim-thread; headless runs step it inline, one tick per frame
+RaceSimulation race;
+bool simThread = true;
+uint32_t raceSeed = 1;
+unsigned int raceCars = 3; // --race-cars N fills the grid behind the original three
+bool raceBench = false; // --race-bench: time the simulation kernel alone and exit
+
+// Counts every allocation for the per-frame "heap allocations" counter. All the
+// replaceable global forms are defined, plain, array, nothrow and aligned, so no
+// allocation gets past the count; each funnels into countedMalloc() or, for
+// over-aligned types, countedAlignedMalloc().
+void* countedMalloc(std::size_t size)
+{
+    ++heapAllocations();
+    heapAllocatedBytes() += size;
+    return malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size)
+{
+    if (void* p = countedMalloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return countedMalloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return countedMalloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+#ifdef __cpp_aligned_new
+void* countedAlignedMalloc(std::size_t size, std::size_t alignment)
+{
+    ++heapAllocations();
+    heapAllocatedBytes() += size;
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, std::max(alignment, sizeof(void*)), size ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+void alignedFree(void* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (void* p = countedAlignedMalloc(size, (std::size_t)alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
 
-    cout << "Lighting Controls" << endl;
-    cout << "Q: Increase the strength of the light" << endl;
-    cout << "E: Decrease the strength of the light" << endl;
-    cout << "SPACEBAR: Toggle Shadows On/Off" << endl;
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return countedAlignedMalloc(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return countedAlignedMalloc(size, (std::size_t)alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    alignedFree(p);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--zero-alloc") == 0)
+            headless = zeroAllocCheck = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            benchmarkFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            benchmarkWarmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-instancing") == 0)
+            instancing = false;
+        else if (strcmp(argv[i], "--no-shadow-cache") == 0)
+            shadowCaching = false;
+        else if (strcmp(argv[i], "--shadow-gs") == 0)
+            shadowFaceCulling = false;
+        else if (strcmp(argv[i], "--no-culling") == 0)
+            frustumCulling = false;
+        else if (strcmp(argv[i], "--no-occlusion") == 0)
+            occlusionCulling = false;
+        else if (strcmp(argv[i], "--no-render-queue") == 0)
+            useRenderQueue = false;
+        else if (strcmp(argv[i], "--no-lod") == 0)
+            lodEnabled = false;
+        else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            lodPixelError = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--shadow-lod-bias") == 0 && i + 1 < argc)
+            shadowLodBias = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--quantize-vertices") == 0)
+            quantizedVertices = true;
+        else if (strcmp(argv[i], "--render-threads") == 0 && i + 1 < argc)
+        {
+            renderQueue = RenderQueue(atoi(argv[i + 1]));
+            lightClusters = LightClusters(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            floodlightCount = (unsigned int)std::min(std::max(0, atoi(argv[++i])), (int)MAX_CLUSTERED_LIGHTS);
+        else if (strcmp(argv[i], "--shadowed-lights") == 0 && i + 1 < argc)
+            shadowedLights = (unsigned int)std::min(std::max(0, atoi(argv[++i])), (int)MAX_SHADOWED_LIGHTS);
+        else if (strcmp(argv[i], "--race-seed") == 0 && i + 1 < argc)
+            raceSeed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--race-cars") == 0 && i + 1 < argc)
+            raceCars = (unsigned int)std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            if (!inputReplay.open(argv[++i]))
+            {
+                cout << "Failed to read input replay: " << argv[i] << endl;
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            goldenPath = argv[++i];
+        else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+            quality.start((float)atof(argv[++i]));
+        else if (strcmp(argv[i], "--track") == 0 && i + 1 < argc)
+            trackPath = argv[++i];
+        else if (strcmp(argv[i], "--stream-radius") == 0 && i + 1 < argc)
+        {
+            // unload a fixed margin further out, so tiles on the edge do not flicker in and out
+            worldStreamer.loadRadius = std::max(1.0f, (float)atof(argv[++i]));
+            worldStreamer.unloadRadius = worldStreamer.loadRadius + 20.0f;
+        }
+        else if (strcmp(argv[i], "--max-tiles") == 0 && i + 1 < argc)
+            worldStreamer.maxResident = (unsigned int)std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+            textureCache().budgetBytes = (size_t)(std::max(0.0, atof(argv[++i])) * 1024.0 * 1024.0);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracer.start(argv[++i]);
+        else if (strcmp(argv[i], "--race-bench") == 0)
+            raceBench = true;
+        else if (strcmp(argv[i], "--no-sim-thread") == 0)
+            simThread = false;
+        else if (strcmp(argv[i], "--bake-meshes") == 0)
+            bakeMeshes = true;
+        else if (strcmp(argv[i], "--no-program-cache") == 0)
+            programCacheEnabled() = false;
+        else if (strcmp(argv[i], "--shadow-filter") == 0 && i + 1 < argc)
+        {
+            ++i;
+            for (int f = 0; f < SHADOW_FILTER_COUNT; ++f)
+                if (strcmp(argv[i], shadowFilterName(f)) == 0)
+                    shadowFilter = (ShadowFilter)f;
+        }
+        else if (strcmp(argv[i], "--shadow-compare") == 0)
+            shadowFilterCompare = true;
+        else if (strcmp(argv[i], "--render-path") == 0 && i + 1 < argc)
+        {
+            ++i;
+            for (int p = 0; p < PATH_COUNT; ++p)
+                if (strcmp(argv[i], renderPathName(p)) == 0)
+                    renderPath = (RenderPath)p;
+        }
+    }
+
+    // the zero-allocation check walks the threaded paths too: clustered floodlights,
+    // and enough cars that the render queue splits its build across the workers on
+    // the frames it draws without instancing (every other frame, see the loop)
+    if (zeroAllocCheck)
+    {
+        floodlightCount = std::max(floodlightCount, 64u);
+        raceCars = std::max(raceCars, RenderQueue::CHUNK * 2 + 1);
+    }
+
+    // simulation throughput only, no window needed
+    if (raceBench)
+    {
+        benchmarkRace(cout, raceCars > 3 ? raceCars : 1u << 20, 600, std::max(1u, std::thread::hardware_concurrency()));
+        return 0;
+    }
+    // recorded and replayed sessions step the race inline at the frame's own time,
+    // so every input lands on the same tick; a replay also brings its own seed
+    if (inputReplay.active())
+    {
+        raceSeed = inputReplay.seed;
+        raceCars = inputReplay.cars;
+        simThread = false;
+        if (quality.enabled)
+        {
+            // the governor reacts to this machine's timings, which would break the golden frames
+            cout << "--frame-budget is ignored while replaying" << endl;
+            quality.start(0.0f);
+        }
+        if (textureCache().budgetBytes > 0)
+        {
+            // reloads finish on the loader threads whenever they finish, so mip levels would differ between runs
+            cout << "--texture-budget is ignored while replaying" << endl;
+            textureCache().budgetBytes = 0;
+        }
+    }
+    else if (!recordPath.empty())
+    {
+        if (!inputRecorder.open(recordPath, raceSeed, raceCars))
+            cout << "Failed to open input recording: " << recordPath << endl;
+        simThread = false;
+    }
+    race.reseed(raceSeed, raceCars);
+
+    // offline conversion: rewrite every .meshcache from its OBJ, no window needed
+    if (bakeMeshes)
+    {
+        int failed = 0;
+        for (unsigned int m = 0; m < MODEL_COUNT; ++m)
+        {
+            ModelData data;
+            bool ok = importObj(modelPaths[m], data) && writeMeshCache(meshCachePath(modelPaths[m]), data);
+            cout << (ok ? "baked " : "FAILED ") << meshCachePath(modelPaths[m]) << endl;
+            failed += ok ? 0 : 1;
+        }
+        return failed;
+    }
+
+    if (!headless)
+    {
+        cout << "MOVEMENT CONTROLS" << endl;
+        cout << "The controls are set up like a 'fly camera'" << endl;
+        cout << "So, use the mouse to look around, and the WASD to move!" << endl;
+        cout << "W: Moves Forward" << endl;
+        cout << "S: Moves Backward" << endl;
+        cout << "A: Strafes Left" << endl;
+        cout << "D: Strafes Right" << endl;
+        cout << "LEFT SHIFT: Engages 'Sprint Move' while held done" << endl;
+        cout << "" << endl;
+    
+        cout << "ANIMATION CONTROLS" << endl;
+        cout << "This scene simulates the most crucial stages of an F1 Race Start - Getting of the line" << endl;
+        cout << "Pressing and holding the 'UP' arrow key gets the cars off the line and allows you to watch the start" << endl;
+        cout << "Pressing 'R' resets the cars to the starting postion" << endl;
+        cout << "Each subsequent race start is always different!" << endl;
+        cout << "" << endl;
+
+        cout << "Lighting Controls" << endl;
+        cout << "Q: Increase the strength of the light" << endl;
+        cout << "E: Decrease the strength of the light" << endl;
+        cout << "SPACEBAR: Toggle Shadows On/Off" << endl;
+        cout << "I: Toggle Instanced Rendering On/Off" << endl;
+        cout << "M: Cycle shadow filtering (PCF / VSM / ESM)" << endl;
+        cout << "P: Cycle render path (forward / depth pre-pass / deferred)" << endl;
+    }
 
 
     // glfw: initialize and configure
     // ------------------------------
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4)
+    // build boxes have no display, so use GLFW's null platform with an offscreen context
+    if (headless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
 
     // glfw window creation
     // --------------------
     GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    if (window == NULL && headless)
+    {
+        // GLFW built without OSMesa, try a surfaceless EGL context instead (Mesa llvmpipe)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -101,11 +554,20 @@ int main()
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    if (!headless)
+    {
+        // may differ from the window size on high-DPI displays
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        outputWidth = width;
+        outputHeight = height;
+    }
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
     // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (!headless)
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
@@ -119,33 +581,74 @@ int main()
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // prefiltered shadow lookups cross face edges
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    //Models
+    // meshes are parsed (or mapped from their cache) and textures decoded on worker
+    // threads while the shaders compile; each model draws nothing until it arrives
+    AssetLoader assetLoader;
+    TextureUploader textureUploader;
+    assetLoadStart = glfwGetTime();
+    placeholderTexture = textureCache().placeholder();
+    for (unsigned int m = 0; m < MODEL_COUNT; ++m)
+    {
+        assetLoader.loadModel(m, modelPaths[m]);
+        models.push_back(RenderModel(ModelData()));
+    }
+    occluderMeshes.resize(MODEL_COUNT);
+
     // build and compile shaders
     // -------------------------
-    Shader mainShader("Glitter/Shaders/mainVert.vert", "Glitter/Shaders/mainFrag.frag");;
-    Shader shadowShader("Glitter/Shaders/shadowVert.vert", "Glitter/Shaders/shadowFrag.frag", "Glitter/Shaders/shadowGeo.geo");
-    Shader skyboxShader("Glitter/Shaders/skybox.vert", "Glitter/Shaders/skybox.frag");
+    // every program that draws model meshes reads them in the layout the RenderModels are uploaded with
+    const std::string meshDefines = quantizedVertices ? "QUANTIZED_VERTICES" : "";
+    // and the programs that light them add the floodlights when there are any
+    const std::string lightDefines = floodlightCount > 0 ? " CLUSTERED_LIGHTS" : "";
+    ShaderProgram mainShader("Glitter/Shaders/mainVert.vert", "Glitter/Shaders/mainFrag.frag", nullptr, meshDefines + lightDefines);
+    ShaderProgram shadowShader("Glitter/Shaders/shadowVert.vert", "Glitter/Shaders/shadowFrag.frag", "Glitter/Shaders/shadowGeo.geo", meshDefines);
+    ShaderProgram skyboxShader("Glitter/Shaders/skybox.vert", "Glitter/Shaders/skybox.frag");
+    ShaderProgram mainInstancedShader("Glitter/Shaders/mainVertInstanced.vert", "Glitter/Shaders/mainFrag.frag", nullptr, meshDefines + lightDefines);
+    ShaderProgram shadowInstancedShader("Glitter/Shaders/shadowVertInstanced.vert", "Glitter/Shaders/shadowFrag.frag", "Glitter/Shaders/shadowGeo.geo", meshDefines);
+    ShaderProgram shadowFaceShader("Glitter/Shaders/shadowFaceVert.vert", "Glitter/Shaders/shadowFrag.frag", nullptr, meshDefines);
+    ShaderProgram shadowFaceInstancedShader("Glitter/Shaders/shadowFaceVertInstanced.vert", "Glitter/Shaders/shadowFrag.frag", nullptr, meshDefines);
+    ShaderProgram shadowAtlasShader("Glitter/Shaders/shadowFaceVert.vert", "Glitter/Shaders/shadowFrag.frag", nullptr, meshDefines + " SHADOW_ATLAS");
+    ShaderProgram shadowAtlasInstancedShader("Glitter/Shaders/shadowFaceVertInstanced.vert", "Glitter/Shaders/shadowFrag.frag", nullptr, meshDefines + " SHADOW_ATLAS");
+    ShaderProgram shadowMomentsShader("Glitter/Shaders/fullscreen.vert", "Glitter/Shaders/shadowMoments.frag");
+    ShaderProgram shadowBlurShader("Glitter/Shaders/fullscreen.vert", "Glitter/Shaders/shadowBlur.frag");
+    ShaderProgram depthOnlyShader("Glitter/Shaders/mainVert.vert", "Glitter/Shaders/depthOnly.frag", nullptr, meshDefines);
+    ShaderProgram depthOnlyInstancedShader("Glitter/Shaders/mainVertInstanced.vert", "Glitter/Shaders/depthOnly.frag", nullptr, meshDefines);
+    ShaderProgram gbufferShader("Glitter/Shaders/mainVert.vert", "Glitter/Shaders/gbuffer.frag", nullptr, meshDefines);
+    ShaderProgram gbufferInstancedShader("Glitter/Shaders/mainVertInstanced.vert", "Glitter/Shaders/gbuffer.frag", nullptr, meshDefines);
+    ShaderProgram deferredLightShader("Glitter/Shaders/fullscreen.vert", "Glitter/Shaders/mainFrag.frag", nullptr, "DEFERRED" + lightDefines);
+
+    // per-frame camera and light state lives in std140 blocks shared by every program
+    UniformBlock<FrameBlock> frameBlock(FRAME_BLOCK_BINDING);
+    UniformBlock<LightBlock> lightBlock(LIGHT_BLOCK_BINDING);
+    UniformBlock<AtlasBlock> atlasBlock(ATLAS_BLOCK_BINDING);
+    for (ShaderProgram* program : { &mainShader, &shadowShader, &skyboxShader, &mainInstancedShader, &shadowInstancedShader,
+                                    &shadowFaceShader, &shadowFaceInstancedShader, &shadowAtlasShader, &shadowAtlasInstancedShader,
+                                    &depthOnlyShader, &depthOnlyInstancedShader, &gbufferShader, &gbufferInstancedShader, &deferredLightShader })
+        bindUniformBlocks(*program);
+    printProgramLoadReport(cout);
     
-    //Models
-    Model Merc("Glitter/Sources/Merc/untitled.obj");
-    Model Renault("Glitter/Sources/Renault/untitled.obj");
-    Model Sphere("Glitter/Sources/Sphere/untitled.obj");
-    Model F1Generic("Glitter/Sources/F1Generic/untitled.obj");
-    Model Road("Glitter/Sources/Road/untitled.obj");
-    Model Grandstand("Glitter/Sources/Grandstand/untitled.obj");
+    for (unsigned int m = 0; m < models.size(); ++m)
+        scene.setModelBounds(m, models[m].bounds);
+    std::map<std::string, unsigned int> trackModels = { { "road", MODEL_ROAD }, { "grandstand", MODEL_GRANDSTAND } };
+    if (!trackPath.empty() && !worldStreamer.open(trackPath, trackModels))
+        cout << "Failed to open track " << trackPath << ", placing the fixed track" << endl;
+    buildScene(!worldStreamer.active());
+    placeFloodlights(floodlightCount);
 
     // configure depth map FBO
     // -----------------------
-    const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+    // face size of the shadow cubemaps, following the quality governor's level
+    unsigned int shadowSize = quality.settings().shadowSize;
     unsigned int depthMapFBO;
     glGenFramebuffers(1, &depthMapFBO);
     // create depth cubemap texture
     unsigned int depthCubemap;
     glGenTextures(1, &depthCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-    for (unsigned int i = 0; i < 6; ++i)
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    allocateShadowCubemap(depthCubemap, shadowSize, shadowSize);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -158,12 +661,62 @@ int main()
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // single-face target for the per-face shadow draws
+    glGenFramebuffers(1, &shadowFaceFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFaceFBO);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // static-only shadow cubemap, copied into depthCubemap every frame before the cars are drawn
+    ShadowCache shadowCache(shadowSize, shadowSize, shadowCacheThreshold);
+    shadowPixelsPerUnit = shadowSize * 0.5f;
+    unsigned int lastDynamicFaces = 0;
+
+    // moments cubemap for VSM/ESM, a quarter of the depth resolution before blurring
+    ShadowPrefilter shadowPrefilter(shadowSize, shadowSize / 4);
+
 
     // shader configuration
     // --------------------
     mainShader.use();
     mainShader.setInt("diffuseTexture", 0);
     mainShader.setInt("depthMap", 1);
+    mainShader.setInt("momentsMap", 2);
+    mainInstancedShader.use();
+    mainInstancedShader.setInt("diffuseTexture", 0);
+    mainInstancedShader.setInt("depthMap", 1);
+    mainInstancedShader.setInt("momentsMap", 2);
+    gbufferShader.use();
+    gbufferShader.setInt("diffuseTexture", 0);
+    gbufferInstancedShader.use();
+    gbufferInstancedShader.setInt("diffuseTexture", 0);
+    deferredLightShader.use();
+    deferredLightShader.setInt("gAlbedo", 0);
+    deferredLightShader.setInt("depthMap", 1);
+    deferredLightShader.setInt("momentsMap", 2);
+    deferredLightShader.setInt("gPosition", 3);
+    deferredLightShader.setInt("gNormal", 4);
+    // floodlight data on units 5-8, for the CLUSTERED_LIGHTS variants
+    for (ShaderProgram* program : { &mainShader, &mainInstancedShader, &deferredLightShader })
+    {
+        program->use();
+        program->setInt("lightData", 5);
+        program->setInt("clusterRanges", 6);
+        program->setInt("clusterLights", 7);
+        program->setInt("shadowAtlas", 8);
+    }
+
+    // floodlight shadows, allocated on first use
+    ShadowAtlas shadowAtlas;
+
+    // deferred path targets, and the attribute-less VAO its fullscreen triangle needs
+    GBuffer gbuffer(outputWidth, outputHeight);
+    unsigned int fullscreenVAO;
+    glGenVertexArrays(1, &fullscreenVAO);
+
+    // reduced-resolution colour/depth for the main pass, allocated the first time the governor scales down
+    ScaledTarget scaledTarget;
 
     //-------------------------------------------------------------------------
     //Everything Relating to the Skybox
@@ -234,16 +787,55 @@ int main()
     };
 
 
-    unsigned int cubemapTexture = loadCubemap(faces);
+    unsigned int cubemapTexture = loadCubemap(faces, assetLoader);
 
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
     //-------------------------------------------------------------------------
 
+    // headless runs draw into an offscreen FBO instead of the default framebuffer
+    unsigned int sceneFBO = 0, sceneColorRBO = 0, sceneDepthRBO = 0;
+    if (headless && !createOffscreenTarget(SCR_WIDTH, SCR_HEIGHT, sceneFBO, sceneColorRBO, sceneDepthRBO))
+    {
+        std::cout << "Failed to create offscreen framebuffer" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+
+    // benchmarks measure the finished scene, not the loading placeholders, and
+    // recorded sessions must see the same scene on replay
+    if (headless || inputReplay.active() || inputRecorder.active())
+    {
+        assetLoader.wait();
+        pumpAssets(assetLoader, textureUploader);
+    }
+
+    profiler.configure(benchmarkWarmup, headless);
+    profiler.reserveFrames(benchmarkFrames);
+    int frameIndex = 0;
+    unsigned int allocatingFrames = 0; // steady frames that reached the heap, for --zero-alloc
+    uint64_t lastMipsDropped = 0, lastTextureReloads = 0;
+    if (headless && !inputReplay.active())
+        race.setAccelerating(true); // the benchmark watches the whole start
+    else if (simThread)
+        race.start();
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
     {
+        if (headless && !inputReplay.active() && frameIndex == benchmarkFrames + benchmarkWarmup)
+            break;
+        if (inputReplay.active() && inputReplay.playedFrames() == inputReplay.frames())
+            break;
+        profiler.beginFrame();
+        tracer.beginFrame();
+        quality.beginFrame();
+        textureCache().beginFrame();
+        frameArena.reset();
+        if (zeroAllocCheck)
+            instancing = frameIndex % 2 == 0;
+
         // per-frame time logic
         // --------------------
         float currentFrame = glfwGetTime();
@@ -252,7 +844,94 @@ int main()
 
         // input
         // -----
-        processInput(window);
+        double simTime = race.clock();
+        tracer.begin("processInput", false);
+        if (inputReplay.active())
+        {
+            // the recorded frame stands in for the clock, the keyboard and the mouse
+            inputReplay.nextFrame(deltaTime, simTime, replayEvents);
+            for (const InputEvent& event : replayEvents)
+            {
+                if (event.type == INPUT_CURSOR)
+                    moveCursor(event.x, event.y);
+                else if (event.type == INPUT_SCROLL)
+                    camera.ProcessMouseScroll(event.y);
+            }
+            processInput(window);
+        }
+        else if (headless)
+            scriptedCamera(frameIndex, benchmarkFrames + benchmarkWarmup);
+        else
+        {
+            inputRecorder.frame(deltaTime, simTime);
+            processInput(window);
+        }
+        tracer.end();
+
+        // swap in whatever finished loading; static geometry changed, so the cached shadows are stale
+        tracer.begin("scene update", false);
+        unsigned int swapped = pumpAssets(assetLoader, textureUploader);
+        if (swapped > 0)
+            shadowCache.invalidate();
+
+        // track tiles in and out of range of the camera; runs that must be repeatable
+        // wait for their tiles, everything else picks them up when the worker is done
+        bool streamed = false;
+        if (worldStreamer.active())
+        {
+            TraceScope trace(tracer, "world streaming");
+            streamed = worldStreamer.update(camera.Position, scene, headless || inputReplay.active() || inputRecorder.active());
+            if (streamed)
+                shadowCache.invalidate();
+        }
+
+        // headless frames are exactly one tick apart, so every run renders the same states;
+        // otherwise draw one tick behind the simulation, blended between its last two ticks
+        if (headless && !inputReplay.active())
+        {
+            race.advanceTo((frameIndex + 1) * RaceSimulation::STEP);
+            race.latest(carZ);
+        }
+        else
+        {
+            if (!simThread)
+                race.advanceTo(simTime);
+            race.sample(simTime - RaceSimulation::STEP, carZ);
+        }
+
+        // push the animated car positions into the scene table and rebuild the
+        // matrices of whatever moved; both passes below reuse the results. The cars
+        // are dynamic instances of three models, so they go out as instanced draws.
+        for (unsigned int c = 0; c < carEntities.size(); ++c)
+            scene.setPosition(carEntities[c], vec3(race.laneX(c), carHeight[c % 3], carZ[c]));
+        unsigned int moved = scene.update();
+        updateInstances(scene, models);
+        if (streamed || sceneBVH.size() != scene.size())
+            sceneBVH.build(scene.worldBounds);
+        else if (moved > 0)
+            sceneBVH.refit(scene.worldBounds);
+        tracer.end();
+
+        // apply the governor's level: main pass resolution and shadow cubemap size
+        // -------------------------------------------------------------------------
+        const QualityLevel& qualityLevel = quality.settings();
+        renderWidth = std::max(1u, (unsigned int)(outputWidth * qualityLevel.renderScale + 0.5f));
+        renderHeight = std::max(1u, (unsigned int)(outputHeight * qualityLevel.renderScale + 0.5f));
+        bool upscale = renderWidth != outputWidth || renderHeight != outputHeight;
+        if (upscale)
+            scaledTarget.resize(renderWidth, renderHeight);
+        unsigned int renderFBO = upscale ? scaledTarget.fbo : sceneFBO;
+        gbuffer.resize(renderWidth, renderHeight);
+        if (qualityLevel.shadowSize != shadowSize)
+        {
+            shadowSize = qualityLevel.shadowSize;
+            allocateShadowCubemap(depthCubemap, shadowSize, shadowSize);
+            shadowCache.resize(shadowSize, shadowSize);
+            shadowPrefilter.resize(shadowSize, shadowSize / 4);
+            shadowPixelsPerUnit = shadowSize * 0.5f;
+            lastDynamicFaces = 0;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, renderFBO);
 
         // Define light position, and attach it just BELLOW the camera to make shadows easier to see.
         vec3 lightPos = camera.Position + vec3(0.0f, -2.0f, 0.0f);
@@ -264,279 +943,926 @@ int main()
 
         // 0. create depth cubemap transformation matrices
         // -----------------------------------------------
+        tracer.begin("shadow matrices", false);
         float near_plane = 1.0f;
         float far_plane = 25.0f;
-        glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, near_plane, far_plane);
-        std::vector<glm::mat4> shadowTransforms;
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+        mat4* shadowTransforms = frameArena.allocate<mat4>(6);
+        cubeFaceMatrices(lightPos, near_plane, far_plane, shadowTransforms);
+        tracer.end();
+
+        // upload this frame's camera and light state once for every pass below
+        // ---------------------------------------------------------------------
+        if (shadowFilterCompare)
+            shadowFilter = (ShadowFilter)(frameIndex % SHADOW_FILTER_COUNT);
+        float aspect = (float)std::max(outputWidth, 1u) / (float)std::max(outputHeight, 1u);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), aspect, 0.1f, 100.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+        Frustum viewFrustum(projection * view);
+        frameBlock.data.projection = projection;
+        frameBlock.data.view = view;
+        frameBlock.data.viewPos = camera.Position;
+        frameBlock.update();
+        for (unsigned int i = 0; i < 6; ++i)
+            lightBlock.data.shadowMatrices[i] = shadowTransforms[i];
+        lightBlock.data.lightPos = lightPos;
+        lightBlock.data.far_plane = far_plane;
+        lightBlock.data.lightStrength = lightStrength;
+        lightBlock.data.shadows = shadows; // enable/disable shadows by pressing 'SPACE'
+        lightBlock.data.shadowFilter = shadowFilter;
+        lightBlock.data.esmExponent = shadowPrefilter.esmExponent;
+        lightBlock.data.shadowSamples = qualityLevel.shadowSamples;
+        lightBlock.update();
+
+        // floodlights: atlas slots for the most important ones, then the clusters
+        // -------------------------------------------------------------------------
+        if (!floodlights.empty())
+        {
+            tracer.begin("light clusters", false);
+            shadowAtlas.assign(floodlights, viewFrustum, camera.Position, shadowedLights, atlasBlock.data);
+            atlasBlock.update();
+            lightClusters.build(floodlights, view, glm::radians(camera.Zoom), aspect, 0.1f, 100.0f);
+            tracer.end();
+            profiler.count("floodlights", (double)floodlights.size());
+            profiler.count("floodlights shadowed", (double)shadowAtlas.shadowed.size());
+            profiler.count("cluster light references", lightClusters.references);
+            profiler.count("cluster max lights", lightClusters.maxPerCluster);
+            tracer.counter("cluster light references", lightClusters.references);
+        }
 
         // 1. render scene to depth cubemap
         // --------------------------------
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        shadowShader.use();
-        for (unsigned int i = 0; i < 6; ++i)
-            shadowShader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
-        shadowShader.setFloat("far_plane", far_plane);
-        shadowShader.setVec3("lightPos", lightPos);
-        renderScene(shadowShader, Merc, F1Generic, Road, Grandstand, Renault);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        profiler.beginPass(PASS_SHADOW);
+        tracer.begin("shadow pass");
+        unsigned int changedFaces = 0x3F; // depth faces rewritten this frame
+        ShaderProgram& shadowProgram = shadowFaceCulling ? (instancing ? shadowFaceInstancedShader : shadowFaceShader)
+                                                  : (instancing ? shadowInstancedShader : shadowShader);
+        shadowProgram.use();
+        if (shadowCaching)
+        {
+            // static geometry only when the light has moved far enough, then copy the
+            // cached faces over and draw the cars into just the faces they can reach
+            unsigned int copyFaces = 0;
+            if (shadowCache.needsRebuild(lightPos))
+            {
+                shadowCache.beginRebuild(lightPos);
+                renderShadowFaces(shadowProgram, shadowCache.cubemap, shadowCache.fbo, 0x3F, shadowTransforms, lightPos, INSTANCES_STATIC);
+                copyFaces = 0x3F;
+                profiler.count("shadow static rebuilds", 1);
+            }
+            Frustum faceFrusta[6];
+            for (unsigned int i = 0; i < 6; ++i)
+                faceFrusta[i] = Frustum(shadowTransforms[i]);
+            unsigned int dynamicFaces = dynamicShadowFaces(faceFrusta);
+            // faces the cars left since last frame need the clean static copy back too
+            copyFaces |= dynamicFaces | lastDynamicFaces;
+            shadowCache.copyFaces(depthCubemap, copyFaces);
+            lastDynamicFaces = dynamicFaces;
+            changedFaces = copyFaces;
+
+            glViewport(0, 0, shadowSize, shadowSize);
+            if (dynamicFaces)
+                renderShadowFaces(shadowProgram, depthCubemap, depthMapFBO, dynamicFaces, shadowTransforms, lightPos, INSTANCES_DYNAMIC);
+            for (unsigned int i = 0; i < 6; ++i)
+            {
+                profiler.count("shadow faces copied", (copyFaces >> i) & 1u);
+                profiler.count("shadow faces dynamic", (dynamicFaces >> i) & 1u);
+            }
+        }
+        else
+        {
+            glViewport(0, 0, shadowSize, shadowSize);
+            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            renderShadowFaces(shadowProgram, depthCubemap, depthMapFBO, 0x3F, shadowTransforms, lightPos, INSTANCES_ALL);
+            shadowCache.invalidate();
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, renderFBO);
+        tracer.end();
+        profiler.endPass(PASS_SHADOW);
+
+        // 1.5 prefilter the faces that changed into the moments cubemap (VSM/ESM)
+        // ---------------------------------------------------------------------
+        if (shadows && shadowFilter != SHADOW_PCF)
+        {
+            profiler.beginPass(PASS_PREFILTER);
+            tracer.begin("prefilter pass");
+            shadowPrefilter.update(depthCubemap, changedFaces, shadowFilter, shadowMomentsShader, shadowBlurShader);
+            glBindFramebuffer(GL_FRAMEBUFFER, renderFBO);
+            tracer.end();
+            profiler.endPass(PASS_PREFILTER);
+        }
+
+        // 1.6 faces of the shadowed floodlights into their atlas tiles
+        // ------------------------------------------------------------
+        if (!shadowAtlas.shadowed.empty())
+        {
+            profiler.beginPass(PASS_ATLAS);
+            tracer.begin("shadow atlas pass");
+            ShaderProgram& atlasProgram = instancing ? shadowAtlasInstancedShader : shadowAtlasShader;
+            atlasProgram.use();
+            renderShadowAtlas(atlasProgram, shadowAtlas, atlasBlock.data);
+            glBindFramebuffer(GL_FRAMEBUFFER, renderFBO);
+            tracer.end();
+            profiler.endPass(PASS_ATLAS);
+        }
 
         // 2. render scene as normal 
         // -------------------------
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        // compare runs time each filter's main pass separately on interleaved frames
+        int mainPass = shadowFilterCompare ? PASS_MAIN_PCF + shadowFilter : PASS_MAIN;
+        profiler.beginPass(mainPass);
+        tracer.begin("main pass");
+        glViewport(0, 0, renderWidth, renderHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        mainShader.use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        mainShader.setMat4("projection", projection);
-        mainShader.setMat4("view", view);
-        // set lighting uniforms
-        mainShader.setVec3("lightPos", lightPos);
-        mainShader.setVec3("viewPos", camera.Position);
-        mainShader.setInt("shadows", shadows); // enable/disable shadows by pressing 'SPACE'
-        mainShader.setFloat("far_plane", far_plane);
+        // forward and pre-pass shade with mainProgram, deferred with the fullscreen lighting pass
+        ShaderProgram& mainProgram = renderPath == PATH_DEFERRED ? deferredLightShader : instancing ? mainInstancedShader : mainShader;
+
+        if (renderPath == PATH_PREPASS)
+        {
+            // depth only, then shade with an equal test so each pixel is lit once
+            ShaderProgram& depthProgram = instancing ? depthOnlyInstancedShader : depthOnlyShader;
+            depthProgram.use();
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            profiler.beginSamples("prepass fragments");
+            if (frustumCulling)
+                renderSceneCulled(depthProgram, viewFrustum, projection * view);
+            else
+                renderScene(depthProgram, false);
+            profiler.endSamples();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        else if (renderPath == PATH_DEFERRED)
+        {
+            // geometry into the G-buffer, then light every covered pixel once
+            ShaderProgram& geometryProgram = instancing ? gbufferInstancedShader : gbufferShader;
+            glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.fbo);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            geometryProgram.use();
+            profiler.beginSamples("gbuffer fragments");
+            if (frustumCulling)
+                renderSceneCulled(geometryProgram, viewFrustum, projection * view);
+            else
+                renderScene(geometryProgram, true);
+            profiler.endSamples();
+            gbuffer.blitDepth(renderFBO);
+            gbuffer.bindTextures(3, 4, 0);
+        }
+
+        mainProgram.use();
         //glActiveTexture(GL_TEXTURE0);
         //glBindTexture(GL_TEXTURE_2D, woodTexture);
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-        renderScene(mainShader, Merc, F1Generic, Road, Grandstand, Renault);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowPrefilter.moments);
+        glActiveTexture(GL_TEXTURE0);
+        renderStats().textureBinds += 2;
+        if (!floodlights.empty())
+        {
+            lightClusters.bindTextures(5, 6, 7);
+            glActiveTexture(GL_TEXTURE8);
+            glBindTexture(GL_TEXTURE_2D, shadowAtlas.texture);
+            glActiveTexture(GL_TEXTURE0);
+            renderStats().textureBinds += 1;
+            mainProgram.setVec2(mainProgram.location("clusterTileScale"), vec2(CLUSTER_X / (float)renderWidth, CLUSTER_Y / (float)renderHeight));
+            mainProgram.setVec2(mainProgram.location("clusterDepth"), vec2(lightClusters.depthScale, lightClusters.depthBias));
+        }
+        // fragments that run the full lighting + shadow shader; per visible pixel this is the overdraw
+        profiler.beginSamples("main fragments shaded");
+        if (renderPath == PATH_DEFERRED)
+        {
+            glDisable(GL_DEPTH_TEST);
+            glBindVertexArray(fullscreenVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            renderStats().drawCalls += 1;
+            renderStats().triangles += 1;
+            glBindVertexArray(0);
+            glEnable(GL_DEPTH_TEST);
+        }
+        else if (frustumCulling)
+            renderSceneCulled(mainProgram, viewFrustum, projection * view, renderPath != PATH_PREPASS);
+        else
+            renderScene(mainProgram, true);
+        profiler.endSamples();
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        tracer.end();
+        profiler.endPass(mainPass);
 
 
         //-----------------------------------------------------------
         //SKYBOX STUFF IN HERE
         // draw skybox as last
+        profiler.beginPass(PASS_SKYBOX);
+        tracer.begin("skybox pass");
         glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
         skyboxShader.use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
         // skybox cube
         glBindVertexArray(skyboxVAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+        renderStats().drawCalls += 1;
+        renderStats().triangles += 12;
+        renderStats().textureBinds += 1;
         glBindVertexArray(0);
         glDepthFunc(GL_LESS); // set depth function back to default
+        tracer.end();
+        profiler.endPass(PASS_SKYBOX);
         //-----------------------------------------------------------
 
+        // stretch a reduced-resolution frame over the output
+        if (upscale)
+        {
+            tracer.begin("upscale blit");
+            scaledTarget.blitTo(sceneFBO, outputWidth, outputHeight);
+            tracer.end();
+        }
+
+        // golden-image checksum of the finished frame, before the swap
+        if (inputReplay.active())
+        {
+            framePixels.resize(outputWidth * outputHeight * 4);
+            glReadPixels(0, 0, outputWidth, outputHeight, GL_RGBA, GL_UNSIGNED_BYTE, framePixels.data());
+            frameChecksums.push_back(imageChecksum(framePixels.data(), framePixels.size()));
+        }
+
+        // frame cost for the governor, measured before the swap so vsync waits do not count
+        quality.pcfShadows = shadowFilter == SHADOW_PCF;
+        if (quality.endFrame())
+        {
+            const QualityLevel& next = quality.settings();
+            std::cout << "quality: level " << quality.level() << " at " << quality.smoothedMs() << " ms for a " << quality.budgetMs
+                      << " ms budget: scale " << next.renderScale << ", shadow " << next.shadowSize << ", " << next.shadowSamples
+                      << " PCF samples" << std::endl;
+            profiler.count("quality changes", 1);
+        }
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+        tracer.begin("glfwSwapBuffers", false);
+        if (headless)
+            glFlush();
+        else
+            glfwSwapBuffers(window);
         glfwPollEvents();
+        tracer.end();
+
+        // textures not bound recently give up mip levels if the cache is over its
+        // budget, and reduced textures that were bound are decoded again
+        TextureCache& textures = textureCache();
+        textures.enforceBudget();
+        textures.requestReloads(assetLoader);
+        profiler.count("texture resident MB", textures.residentBytes / (1024.0 * 1024.0));
+        profiler.count("texture mips dropped", (double)(textures.mipsDropped - lastMipsDropped));
+        profiler.count("texture reloads", (double)(textures.reloads - lastTextureReloads));
+        tracer.counter("texture resident MB", textures.residentBytes / (1024.0 * 1024.0));
+        lastMipsDropped = textures.mipsDropped;
+        lastTextureReloads = textures.reloads;
+        if (worldStreamer.active())
+        {
+            profiler.count("tiles resident", worldStreamer.resident());
+            profiler.count("tiles loading", worldStreamer.loading());
+            tracer.counter("tiles resident", worldStreamer.resident());
+        }
+
+        RenderStats& stats = renderStats();
+        unsigned int blockUploads = frameBlock.takeUploads() + lightBlock.takeUploads() + atlasBlock.takeUploads();
+        uint64_t allocations = heapAllocations().exchange(0);
+        uint64_t allocatedBytes = heapAllocatedBytes().exchange(0);
+        profiler.count("state changes", renderQueue.stateChanges);
+        profiler.count("state changes skipped", renderQueue.stateChangesSkipped);
+        profiler.count("uniform calls", ShaderProgram::uniformCalls());
+        profiler.count("uniform block uploads", blockUploads);
+        profiler.count("draw calls", (double)stats.drawCalls);
+        profiler.count("triangles drawn", (double)stats.triangles);
+        profiler.count("texture binds", (double)stats.textureBinds);
+        profiler.count("heap allocations", (double)allocations);
+        tracer.counter("draw calls", (double)stats.drawCalls);
+        tracer.counter("triangles", (double)stats.triangles);
+        tracer.counter("uniform calls", ShaderProgram::uniformCalls());
+        tracer.counter("uniform block uploads", blockUploads);
+        tracer.counter("texture binds", (double)stats.textureBinds);
+        tracer.counter("heap allocations", (double)allocations);
+        profiler.count("frame arena KB", frameArena.bytesUsed() / 1024.0);
+        // steady frames: past the warm-up, with nothing new loaded or streamed in
+        if (zeroAllocCheck && allocations > 0 && frameIndex >= benchmarkWarmup && swapped == 0 && !streamed)
+        {
+            std::cout << "zero-alloc: frame " << frameIndex << " made " << allocations << " heap allocations (" << allocatedBytes << " bytes)" << std::endl;
+            ++allocatingFrames;
+        }
+        if (quality.enabled)
+        {
+            profiler.count("quality level", quality.level());
+            profiler.count("render pixels", (double)renderWidth * renderHeight);
+            tracer.counter("quality level", quality.level());
+            tracer.counter("governed frame ms", quality.smoothedMs());
+        }
+        renderQueue.stateChanges = renderQueue.stateChangesSkipped = 0;
+        ShaderProgram::uniformCalls() = 0;
+        stats = RenderStats();
+        tracer.endFrame();
+        profiler.endFrame();
+        ++frameIndex;
+    }
+
+    race.stop();
+    if (!tracer.finish())
+        std::cout << "Failed to write trace file" << std::endl;
+    if (inputRecorder.active())
+    {
+        std::cout << "recorded " << inputRecorder.recordedFrames() << " frames to " << recordPath << std::endl;
+        inputRecorder.close();
+    }
+    int mismatches = finishReplay();
+    if (zeroAllocCheck)
+        std::cout << "zero-alloc: " << (allocatingFrames == 0 ? "passed" : "FAILED") << ", " << allocatingFrames << " steady frames allocated; frame arena peak "
+                  << frameArena.highWater << " bytes, " << frameArena.spills << " spills" << std::endl;
+    if (worldStreamer.active())
+        std::cout << "streaming: " << worldStreamer.tileCount() << " tiles, " << worldStreamer.loads << " loads, " << worldStreamer.unloads
+                  << " unloads, " << worldStreamer.cancelled << " cancelled, load latency " << worldStreamer.averageLatencyMs()
+                  << " ms average, " << worldStreamer.latencyMaxMs << " ms worst" << std::endl;
+    const TextureCache& textures = textureCache();
+    std::cout << "texture cache: " << textures.textures() << " textures, " << textures.hits << "/" << textures.hits + textures.misses
+              << " hits (" << textures.hitRate() * 100.0 << "%), " << textures.residentBytes / (1024.0 * 1024.0) << " MB resident, "
+              << textures.reduced() << " reduced, " << textures.mipsDropped << " mips dropped, " << textures.reloads << " reloads" << std::endl;
+    if (quality.enabled)
+        std::cout << "quality: " << quality.downgrades << " downgrades, " << quality.upgrades << " upgrades, final level "
+                  << quality.level() << " of " << QUALITY_LEVEL_COUNT - 1 << std::endl;
+    if (headless)
+    {
+        profiler.finish();
+        std::cout << "renderer: " << glGetString(GL_RENDERER) << std::endl;
+        std::cout << "race: " << race.cars() << " cars, tick " << race.ticks() << ", state hash " << std::hex << race.hash() << std::dec << std::endl;
+        profiler.report(std::cout);
+        glDeleteFramebuffers(1, &sceneFBO);
+        glDeleteRenderbuffers(1, &sceneColorRBO);
+        glDeleteRenderbuffers(1, &sceneDepthRBO);
     }
 
     glfwTerminate();
-    return 0;
+    return mismatches > 0 || allocatingFrames > 0 ? 1 : 0;
 }
 
-// renders the 3D scene
-// --------------------
-void renderScene(Shader& shader, Model& Merc, Model& F1Generic, Model& Road, Model& Grandstand, Model& Renault)
+// places every object in the scene table; without fixedTrack only the cars,
+// the road and grandstands then come from the world streamer
+// ---------------------------------------------------------------------------
+void buildScene(bool fixedTrack)
 {
-
-    //Model stack and transformations
-    stack<mat4> model;
-    model.push(mat4(1.0));
-    shader.setMat4("model", model.top());
-    shader.setVec3("lightStrength", lightStrength);
-
-    //Generic F1 Car
-    model.push(model.top());
+    // Cars: starting grid, animated through setPosition every frame. The first three
+    // are the F1Generic in "1st Place", the Renault in "2nd" and the Merc in "3rd".
+    race.latest(carZ);
+    for (unsigned int c = 0; c < race.cars(); ++c)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(F1GenericGoX, F1GenericGoY, F1GenericGoZ)); // Setting up in "1st Place" + Animation
-        //model.top() = glm::translate(model.top(), glm::vec3(-1.3f, 0.0f, 0.0f)); // Setting up in "1st Place"
-        model.top() = glm::scale(model.top(), glm::vec3(1.0f, 1.0f, 1.0f));	// Size it
-        shader.setMat4("model", model.top());
+        unsigned int entity = scene.add(carModels[c % 3], vec3(race.laneX(c), carHeight[c % 3], carZ[c]), quat(1.0f, 0.0f, 0.0f, 0.0f), vec3(carScale[c % 3]));
+        scene.setDynamic(entity, true);
+        carEntities.push_back(entity);
+    }
+    if (!fixedTrack)
+        return;
+
+    // Road segments down the center
+    const float roadZ[] = { -8.0f, 10.0f, 28.0f };
+    for (float z : roadZ)
+        scene.add(MODEL_ROAD, vec3(0.0f, 0.0f, z), quat(1.0f, 0.0f, 0.0f, 0.0f), vec3(150.0f, 100.0f, 150.0f));
+
+    // Grandstands: the right one is the left one turned 180 degrees about Y,
+    // so its offset (33.5, -6.4, -16.05) is rotated into world space as well
+    scene.add(MODEL_GRANDSTAND, vec3(-33.5f, -6.4f, 16.05f), angleAxis(radians(180.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(0.2f)); // right
+    scene.add(MODEL_GRANDSTAND, vec3(33.5f, -6.4f, 15.78f), quat(1.0f, 0.0f, 0.0f, 0.0f), vec3(0.2f)); // left
+}
 
+// draws an entity set into the faces of a shadow cubemap selected by faceMask.
+// With shadowFaceCulling every face is a separate draw of just the objects whose
+// bounds touch that face's frustum; otherwise the geometry shader fans each
+// triangle out to all selected faces of the layered FBO.
+// Culled draws use LODs picked from the light's point of view, with the shadow bias.
+// ------------------------------------------------------------------------------
+void renderShadowFaces(ShaderProgram& shader, unsigned int cubemap, unsigned int layeredFBO, unsigned int faceMask, const mat4 shadowTransforms[6], vec3 lightPos, InstanceSet set)
+{
+    TraceScope trace(tracer, "renderShadowFaces");
 
-        F1Generic.Draw(shader);
-    }
-    model.pop();
+    unsigned int faceCount = 0;
+    for (unsigned int f = 0; f < 6; ++f)
+        faceCount += (faceMask >> f) & 1u;
 
-    //Renault
-    model.push(model.top());
+    if (!shadowFaceCulling)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(RenaultGoX, RenaultGoY, RenaultGoZ)); // Setting up in "1st Place" + Animation
-        //model.top() = glm::translate(model.top(), glm::vec3(1.4f, 0.4f, -5.0f)); // Setting up in "2nd Place"
-        model.top() = glm::scale(model.top(), glm::vec3(0.7f, 0.7f, 0.7f));	// Sizing
-        shader.setMat4("model", model.top());
-
-        Renault.Draw(shader);
+        glBindFramebuffer(GL_FRAMEBUFFER, layeredFBO);
+        shader.setInt("faceMask", faceMask);
+        renderScene(shader, false, set);
+        for (unsigned int i = 0; i < scene.size(); ++i)
+            if (set == INSTANCES_ALL || (set == INSTANCES_DYNAMIC) == (scene.dynamic[i] != 0))
+                profiler.count("shadow triangle-faces", models[scene.model[i]].triangles * faceCount);
+        return;
     }
-    model.pop();
 
-    //Merc
-    model.push(model.top());
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFaceFBO);
+    drawShadowFaces(shader, shadowTransforms, faceMask, lightPos, shadowPixelsPerUnit, set, [&](unsigned int f)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(MercGoX, MercGoY, MercGoZ)); // Setting up in "1st Place" + Animation
-        //model.top() = glm::translate(model.top(), glm::vec3(-1.4f, 0.4f, -10.2f)); // Setting up in "3rd Place"
-        model.top() = glm::scale(model.top(), glm::vec3(0.7f, 0.7f, 0.7f));	// Sizing
-        shader.setMat4("model", model.top());
-
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, cubemap, 0);
+        shader.setInt("face", (int)f);
+    });
+}
 
-        Merc.Draw(shader);
+// floodlight shadows: the six faces of every light that holds an atlas slot,
+// each into its own tile, culled per face like the main shadow cubemap
+// --------------------------------------------------------------------------
+void renderShadowAtlas(ShaderProgram& shader, ShadowAtlas& atlas, const AtlasBlock& block)
+{
+    TraceScope trace(tracer, "renderShadowAtlas");
+    glBindFramebuffer(GL_FRAMEBUFFER, atlas.fbo);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    GLint faceLocation = shader.location("face");
+    for (unsigned int slot = 0; slot < atlas.shadowed.size(); ++slot)
+    {
+        drawShadowFaces(shader, &block.faceMatrices[slot * 6], 0x3F, vec3(block.lights[slot]), atlas.tileSize * 0.5f, INSTANCES_ALL, [&](unsigned int f)
+        {
+            atlas.setViewport(slot, f);
+            shader.setInt(faceLocation, (int)(slot * 6 + f));
+        });
     }
-    model.pop();
+}
 
-    //Road
-    model.push(model.top());
+// per-face culled shadow draws of an entity set: each face's frustum picks the
+// objects, minus those hidden from the light by occluders, and their LODs come
+// from the light's point of view; bindFace(f) points the output at face f and
+// sets the shader's face before that face is drawn. A template rather than a
+// std::function, which would box the atlas's four captures on the heap per light.
+// ------------------------------------------------------------------------------
+template <typename BindFace>
+void drawShadowFaces(ShaderProgram& shader, const mat4 faceMatrices[6], unsigned int faceMask, vec3 lightPos, float pixelsPerUnit, InstanceSet set, const BindFace& bindFace)
+{
+    Frustum frusta[6];
+    for (unsigned int f = 0; f < 6; ++f)
+        frusta[f] = Frustum(faceMatrices[f]);
+    // a caster the light cannot see only shades what its occluder already shades
+    auto cullFace = [&](unsigned int f)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(0.0f, 0.0f, -8.0f)); // Road in the center
-        model.top() = glm::scale(model.top(), glm::vec3(150.0f, 100.0f, 150.0f));	// Sizing
-        shader.setMat4("model", model.top());
-
-        //Light Properties
-
-
-        Road.Draw(shader);
+        cullEntities(frusta[f], set, visibleEntities);
+        if (occlusionCulling)
+            cullOccluded(faceMatrices[f], visibleEntities, [&](unsigned int i) { return selectLod(i, lightPos, pixelsPerUnit, shadowLodBias); },
+                         "shadow objects occluded", "shadow triangles occluded");
+    };
 
-        //Resetting light properties
+    unsigned int setSize = 0;
+    for (unsigned int i = 0; i < scene.size(); ++i)
+        if (set == INSTANCES_ALL || (scene.dynamic[i] != 0) == (set == INSTANCES_DYNAMIC))
+            ++setSize;
 
+    if (instancing)
+    {
+        // cull once into per-face ranges of each model's visible buffer
+        for (RenderModel& renderModel : models)
+            renderModel.clearVisible();
+        for (unsigned int f = 0; f < 6; ++f)
+        {
+            if (!(faceMask & (1u << f)))
+                continue;
+            cullFace(f);
+            profiler.count("shadow objects culled", (double)(setSize - visibleEntities.size()));
+            for (unsigned int i : visibleEntities)
+                models[scene.model[i]].addVisible({ scene.world[i], scene.normal[i] }, selectLod(i, lightPos, pixelsPerUnit, shadowLodBias));
+            for (RenderModel& renderModel : models)
+                renderModel.endView(f);
+        }
+        for (RenderModel& renderModel : models)
+            renderModel.uploadVisible();
     }
-    model.pop();
 
-    //Road
-    model.push(model.top());
+    for (unsigned int f = 0; f < 6; ++f)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(0.0f, 0.0f, 10.0f)); // Road in the center
-        model.top() = glm::scale(model.top(), glm::vec3(150.0f, 100.0f, 150.0f));	// Sizing
-        shader.setMat4("model", model.top());
-
-        //Light Properties
-
+        if (!(faceMask & (1u << f)))
+            continue;
+        bindFace(f);
+        if (instancing)
+        {
+            for (RenderModel& renderModel : models)
+            {
+                renderModel.DrawVisible(shader, f);
+                profiler.count("shadow triangle-faces", renderModel.viewTriangles(f));
+            }
+            continue;
+        }
+        cullFace(f);
+        profiler.count("shadow objects culled", (double)(setSize - visibleEntities.size()));
+        for (unsigned int i : visibleEntities)
+        {
+            unsigned int lod = std::min(selectLod(i, lightPos, pixelsPerUnit, shadowLodBias), models[scene.model[i]].lodCount - 1);
+            shader.setMat4(shader.location("model"), scene.world[i]);
+            models[scene.model[i]].Draw(shader, lod);
+            profiler.count("shadow triangle-faces", models[scene.model[i]].lodTriangles[lod]);
+        }
+    }
+}
 
-        Road.Draw(shader);
+// ids of the entities in `set` that touch the frustum, found through the scene BVH
+// ---------------------------------------------------------------------------------
+void cullEntities(const Frustum& frustum, InstanceSet set, vector<unsigned int>& visible)
+{
+    visible.clear();
+    sceneBVH.cull(frustum, scene.worldBounds, visible);
+    if (set == INSTANCES_ALL)
+        return;
+    unsigned int kept = 0;
+    for (unsigned int i : visible)
+        if ((scene.dynamic[i] != 0) == (set == INSTANCES_DYNAMIC))
+            visible[kept++] = i;
+    visible.resize(kept);
+}
 
-        //Resetting light properties
+// Hi-Z occlusion of a frustum-culled entity list: the occluders among the entities
+// are rasterized from viewProjection, then every entity they fully hide is removed
+// from the list. lodOf gives the LOD an entity would be drawn at, for the count of
+// triangles saved; a template like drawShadowFaces' callback, so it is never boxed.
+// -------------------------------------------------------------------------------
+template <typename LodOf>
+void cullOccluded(const mat4& viewProjection, vector<unsigned int>& entities, const LodOf& lodOf, const char* objectsCounter, const char* trianglesCounter)
+{
+    TraceScope trace(tracer, "cullOccluded");
+    occlusionBuffer.begin(viewProjection);
+    for (unsigned int i : entities)
+        if (!occluderMeshes[scene.model[i]].empty())
+            occlusionBuffer.rasterize(occluderMeshes[scene.model[i]], scene.world[i]);
+    if (occlusionBuffer.occluderTriangles == 0)
+        return;
+    occlusionBuffer.buildPyramid();
+
+    unsigned int kept = 0, occluded = 0, triangles = 0;
+    for (unsigned int i : entities)
+    {
+        if (!occlusionBuffer.occluded(scene.worldBounds[i]))
+        {
+            entities[kept++] = i;
+            continue;
+        }
+        const RenderModel& renderModel = models[scene.model[i]];
+        ++occluded;
+        triangles += renderModel.lodTriangles[std::min(lodOf(i), renderModel.lodCount - 1)];
     }
-    model.pop();
+    entities.resize(kept);
+    profiler.count(objectsCounter, occluded);
+    profiler.count(trianglesCounter, triangles);
+    profiler.count("occluder triangles", occlusionBuffer.occluderTriangles);
+}
 
-    //Road
-    model.push(model.top());
+// bitmask of the shadow cubemap faces that any moving object overlaps
+// --------------------------------------------------------------------
+unsigned int dynamicShadowFaces(const Frustum faces[6])
+{
+    unsigned int mask = 0;
+    for (unsigned int i = 0; i < scene.size(); ++i)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(0.0f, 0.0f, 28.0f)); // Road in the center
-        model.top() = glm::scale(model.top(), glm::vec3(150.0f, 100.0f, 150.0f));	// Sizing
-        shader.setMat4("model", model.top());
-
-        //Light Properties
+        if (!scene.dynamic[i])
+            continue;
+        for (unsigned int f = 0; f < 6; ++f)
+            if (faces[f].intersects(scene.worldBounds[i]))
+                mask |= 1u << f;
+    }
+    return mask;
+}
 
+// renders the 3D scene from the matrices cached in the scene table, either one
+// instanced draw per mesh (instancing on) or one draw per placed object
+// ------------------------------------------------------------------------------
+void renderScene(ShaderProgram& shader, bool normals, InstanceSet set)
+{
+    TraceScope trace(tracer, "renderScene");
+    if (instancing)
+    {
+        for (RenderModel& renderModel : models)
+            renderModel.DrawInstanced(shader, set);
+        return;
+    }
 
-        Road.Draw(shader);
+    if (useRenderQueue)
+    {
+        queueEntities.clear();
+        for (unsigned int i = 0; i < scene.size(); ++i)
+            if (!((set == INSTANCES_STATIC && scene.dynamic[i]) || (set == INSTANCES_DYNAMIC && !scene.dynamic[i])))
+                queueEntities.push_back(i);
+        renderQueue.build(scene, models, queueEntities, nullptr, camera.Position, 100.0f, shader.ID);
+        profiler.count("draw packets", (double)renderQueue.packets.size());
+        renderQueue.submit(shader, scene, models, normals);
+        return;
+    }
 
-        //Resetting light properties
+    // per-object matrices are the only uniforms set per draw
+    GLint modelLocation = shader.location("model");
+    GLint normalLocation = shader.location("normalMatrix");
+    for (unsigned int i = 0; i < scene.size(); ++i)
+    {
+        if ((set == INSTANCES_STATIC && scene.dynamic[i]) || (set == INSTANCES_DYNAMIC && !scene.dynamic[i]))
+            continue;
+        shader.setMat4(modelLocation, scene.world[i]);
+        if (normals)
+            shader.setMat3(normalLocation, scene.normal[i]);
+        models[scene.model[i]].Draw(shader);
+        for (const RenderMesh& mesh : models[scene.model[i]].meshes)
+            renderQueue.stateChanges += (unsigned int)mesh.textures.size() * 2 + 3; // what DrawMesh binds and unbinds
     }
-    model.pop();
+}
 
+// main pass with view-frustum culling: BVH query for whole objects, then a
+// per-mesh bounds test when objects are drawn one at a time. With the render
+// queue the per-mesh test happens while the packets are built.
+// ---------------------------------------------------------------------------
+void renderSceneCulled(ShaderProgram& shader, const Frustum& frustum, const mat4& viewProjection, bool recull)
+{
+    TraceScope trace(tracer, "renderSceneCulled");
+    // a second draw of the same view (depth pre-pass) reuses the first one's culling
+    if (recull)
+    {
+        cullEntities(frustum, INSTANCES_ALL, visibleEntities);
+        profiler.count("main objects visible", (double)visibleEntities.size());
+        profiler.count("main objects culled", (double)(scene.size() - visibleEntities.size()));
+    }
 
-    //Grandstand right
-    model.push(model.top());
+    // LOD per visible object, from the size of each level's error on screen
+    if (recull)
     {
-        // render the loaded model
+        float pixelsPerUnit = renderHeight / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+        entityLod.resize(scene.size());
+        for (unsigned int i : visibleEntities)
+            entityLod[i] = (unsigned char)selectLod(i, camera.Position, pixelsPerUnit, 1.0f);
+        if (occlusionCulling)
+            cullOccluded(viewProjection, visibleEntities, [](unsigned int i) { return (unsigned int)entityLod[i]; },
+                         "main objects occluded", "main triangles occluded");
+    }
 
-        model.top() = glm::rotate(model.top(), radians(180.0f), vec3(0.0f, 1.0f, 0.0f));
-        model.top() = glm::translate(model.top(), glm::vec3(33.5f, -6.4f, -16.05f)); // Off too the left
-        model.top() = glm::scale(model.top(), glm::vec3(0.2f, 0.2f, 0.2f));	// Sizing
-        shader.setMat4("model", model.top());
+    if (instancing)
+    {
+        if (recull)
+        {
+            for (RenderModel& renderModel : models)
+                renderModel.clearVisible();
+            for (unsigned int i : visibleEntities)
+                models[scene.model[i]].addVisible({ scene.world[i], scene.normal[i] }, entityLod[i]);
+            for (RenderModel& renderModel : models)
+            {
+                renderModel.endView(0);
+                renderModel.uploadVisible();
+                profiler.count("main triangles", renderModel.viewTriangles(0));
+            }
+        }
+        for (RenderModel& renderModel : models)
+            renderModel.DrawVisible(shader, 0);
+        return;
+    }
 
-        Grandstand.Draw(shader);
+    if (useRenderQueue)
+    {
+        // the sorted packets stay valid for a second draw of the same view
+        if (recull)
+        {
+            renderQueue.meshesCulled = 0;
+            renderQueue.build(scene, models, visibleEntities, &frustum, camera.Position, 100.0f, shader.ID, entityLod.data());
+            profiler.count("draw packets", (double)renderQueue.packets.size());
+            profiler.count("main meshes culled", renderQueue.meshesCulled);
+        }
+        renderQueue.submit(shader, scene, models, true);
+        return;
     }
-    model.pop();
 
-    //Grandstand left
-    model.push(model.top());
+    GLint modelLocation = shader.location("model");
+    GLint normalLocation = shader.location("normalMatrix");
+    for (unsigned int i : visibleEntities)
     {
-        // render the loaded model
-        model.top() = glm::translate(model.top(), glm::vec3(33.5f, -6.4f, 15.78f)); // Off too the left
-        model.top() = glm::scale(model.top(), glm::vec3(0.2f, 0.2f, 0.2f));	// Sizing
-        shader.setMat4("model", model.top());
+        RenderModel& renderModel = models[scene.model[i]];
+        shader.setMat4(modelLocation, scene.world[i]);
+        shader.setMat3(normalLocation, scene.normal[i]);
+        for (unsigned int m = 0; m < renderModel.meshes.size(); ++m)
+        {
+            if (!frustum.intersects(renderModel.meshBounds[m].transformed(scene.world[i])))
+            {
+                if (recull)
+                    profiler.count("main meshes culled", 1);
+                continue;
+            }
+            renderModel.DrawMesh(shader, m, std::min<unsigned int>(entityLod[i], renderModel.meshes[m].lodCount - 1));
+            renderQueue.stateChanges += (unsigned int)renderModel.meshes[m].textures.size() * 2 + 3; // what DrawMesh binds and unbinds
+        }
+    }
+}
+
 
-        Grandstand.Draw(shader);
+// --lights N: floodlights on poles down both sides of the track, warm white with
+// a little variation per light, the same on every run
+// -------------------------------------------------------------------------------
+void placeFloodlights(unsigned int count)
+{
+    floodlights.clear();
+    unsigned int rows = (count + 1) / 2;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        uint32_t h = (i + 1) * 2654435761u; // Knuth's multiplicative hash, for the variation
+        float side = (i & 1) ? 1.0f : -1.0f;
+        PointLight light;
+        light.position = vec3(side * (6.0f + 3.0f * ((h >> 8) % 4)), 3.0f + (float)((h >> 12) % 4), -16.0f + 52.0f * (i / 2 + 0.5f) / rows);
+        light.radius = 6.0f + (float)((h >> 16) % 5);
+        light.color = vec3(1.0f, 0.8f + 0.05f * ((h >> 20) % 4), 0.6f + 0.1f * ((h >> 24) % 4)) * 3.0f;
+        light.shadowSlot = -1;
+        floodlights.push_back(light);
     }
-    model.pop();
 }
 
+// coarsest LOD of the entity's model whose simplification error, scaled into
+// world space and projected at the entity's distance, stays within
+// lodPixelError * bias pixels. pixelsPerUnit is the view's pixels per unit of
+// size at distance 1.
+// ----------------------------------------------------------------------------
+unsigned int selectLod(unsigned int entity, vec3 eye, float pixelsPerUnit, float bias)
+{
+    const RenderModel& renderModel = models[scene.model[entity]];
+    if (!lodEnabled || renderModel.lodCount < 2)
+        return 0;
+    const mat4& world = scene.world[entity];
+    float scale = std::max(length(vec3(world[0])), std::max(length(vec3(world[1])), length(vec3(world[2]))));
+    const AABB& bounds = scene.worldBounds[entity];
+    float distance = std::max(length(bounds.center() - eye) - length(bounds.extent()), 0.1f);
+    for (unsigned int l = renderModel.lodCount - 1; l > 0; --l)
+        if (renderModel.lodError[l] * scale / distance * pixelsPerUnit <= lodPixelError * bias)
+            return l;
+    return 0;
+}
+
+// a polled key: from the replay when one runs, otherwise from GLFW, recording the change
+// -------------------------------------------------------------------------------------
+bool keyDown(GLFWwindow* window, int key)
+{
+    if (inputReplay.active())
+        return inputReplay.keyDown(key);
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    inputRecorder.key(key, down);
+    return down;
+}
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow* window)
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    if (keyDown(window, GLFW_KEY_ESCAPE))
         glfwSetWindowShouldClose(window, true);
 
-    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
+    if (keyDown(window, GLFW_KEY_LEFT_SHIFT)) {
         camera.sprint(12.5f);
     }
     else {
         camera.walk(2.5f);
     }
 
-    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-        //Stopping the cars from going off track after the start phase
-        if (F1GenericGoZ < 34.5 && RenaultGoZ < 34.5) {
-            F1GenericGoZ += car1;
-            RenaultGoZ += car2;
-            MercGoZ += car3;
-        }
-    }
+    // the simulation reads these at its next tick
+    race.setAccelerating(keyDown(window, GLFW_KEY_UP));
 
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-        Icar1 = rand() % 70 + 30;
-        Icar2 = rand() % 70 + 30;
-        Icar3 = rand() % Icar1 + 30;
-        while (Icar3 > Icar1) {
-            Icar3 = rand() % Icar1 + 30;
-        }
-        car1 = static_cast<float>(Icar1) / 1000;
-        car2 = static_cast<float>(Icar2) / 1000;
-        car3 = static_cast<float>(Icar3) / 1000;
-        F1GenericGoZ = 0.0;
-        RenaultGoZ = -5.0;
-        MercGoZ = -10.2;
+    if (keyDown(window, GLFW_KEY_R)) {
+        race.requestReset();
     }
 
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+    if (keyDown(window, GLFW_KEY_Q)) {
         if (lightStrength.x < 0.9f) {
             lightStrength += 0.005;
         }
     }
 
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
+    if (keyDown(window, GLFW_KEY_E)) {
         if (lightStrength.x > 0.1f) {
             lightStrength -= 0.005;
         }
     }
     
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (keyDown(window, GLFW_KEY_W))
         camera.ProcessKeyboard(FORWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (keyDown(window, GLFW_KEY_S))
         camera.ProcessKeyboard(BACKWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (keyDown(window, GLFW_KEY_A))
         camera.ProcessKeyboard(LEFT, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (keyDown(window, GLFW_KEY_D))
         camera.ProcessKeyboard(RIGHT, deltaTime);
     
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !shadowsKeyPressed)
+    if (keyDown(window, GLFW_KEY_SPACE) && !shadowsKeyPressed)
     {
         shadows = !shadows;
         shadowsKeyPressed = true;
     }
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE)
+    if (!keyDown(window, GLFW_KEY_SPACE))
     {
         shadowsKeyPressed = false;
     }
+
+    if (keyDown(window, GLFW_KEY_I) && !instancingKeyPressed)
+    {
+        instancing = !instancing;
+        instancingKeyPressed = true;
+    }
+    if (!keyDown(window, GLFW_KEY_I))
+    {
+        instancingKeyPressed = false;
+    }
+
+    if (keyDown(window, GLFW_KEY_M) && !shadowFilterKeyPressed)
+    {
+        shadowFilter = (ShadowFilter)((shadowFilter + 1) % SHADOW_FILTER_COUNT);
+        std::cout << "Shadow filter: " << shadowFilterName(shadowFilter) << std::endl;
+        shadowFilterKeyPressed = true;
+    }
+    if (!keyDown(window, GLFW_KEY_M))
+    {
+        shadowFilterKeyPressed = false;
+    }
+
+    if (keyDown(window, GLFW_KEY_P) && !renderPathKeyPressed)
+    {
+        renderPath = (RenderPath)((renderPath + 1) % PATH_COUNT);
+        std::cout << "Render path: " << renderPathName(renderPath) << std::endl;
+        renderPathKeyPressed = true;
+    }
+    if (!keyDown(window, GLFW_KEY_P))
+    {
+        renderPathKeyPressed = false;
+    }
+
+    if (keyDown(window, GLFW_KEY_O) && !occlusionKeyPressed)
+    {
+        occlusionCulling = !occlusionCulling;
+        std::cout << "Occlusion culling: " << (occlusionCulling ? "on" : "off") << std::endl;
+        occlusionKeyPressed = true;
+    }
+    if (!keyDown(window, GLFW_KEY_O))
+    {
+        occlusionKeyPressed = false;
+    }
+}
+
+// benchmark camera: a fixed fly-through so every headless run renders the same frames
+// ------------------------------------------------------------------------------------
+void scriptedCamera(int frame, int frameCount)
+{
+    float t = frameCount > 1 ? static_cast<float>(frame) / (frameCount - 1) : 0.0f;
+
+    // dolly from behind the grid down to the end of the straight, sweeping the view
+    // across both grandstands on the way, while the race start plays out
+    camera.Position = vec3(2.0f * std::sin(t * 6.2831853f), 3.0f, -14.0f + 44.0f * t);
+    camera.Yaw = 90.0f + 60.0f * std::sin(t * 12.566371f);
+    camera.Pitch = -15.0f;
+    camera.ProcessMouseMovement(0.0f, 0.0f); // refresh Front/Right/Up from Yaw/Pitch
+}
+
+// End of a replay: prints the session checksum, then writes the per-frame image
+// checksums to --golden, or compares with it when the file already exists.
+// Returns the number of frames that differ from the golden run.
+// ------------------------------------------------------------------------------
+int finishReplay()
+{
+    if (!inputReplay.active())
+        return 0;
+    uint64_t session = imageChecksum((const unsigned char*)frameChecksums.data(), frameChecksums.size() * sizeof(uint64_t));
+    std::cout << "replay: " << frameChecksums.size() << " frames, image checksum " << std::hex << session
+              << ", race state hash " << race.hash() << std::dec << std::endl;
+    if (goldenPath.empty())
+        return 0;
+
+    vector<uint64_t> golden;
+    if (FILE* file = fopen(goldenPath.c_str(), "r"))
+    {
+        unsigned int frame;
+        unsigned long long checksum;
+        while (fscanf(file, "%u %llx", &frame, &checksum) == 2)
+            golden.push_back(checksum);
+        fclose(file);
+    }
+    else
+    {
+        FILE* out = fopen(goldenPath.c_str(), "w");
+        if (!out)
+        {
+            std::cout << "Failed to write golden checksums: " << goldenPath << std::endl;
+            return 0;
+        }
+        for (size_t f = 0; f < frameChecksums.size(); ++f)
+            fprintf(out, "%u %016llx\n", (unsigned int)f, (unsigned long long)frameChecksums[f]);
+        fclose(out);
+        std::cout << "golden checksums written to " << goldenPath << std::endl;
+        return 0;
+    }
+
+    int mismatches = golden.size() == frameChecksums.size() ? 0 : 1;
+    int first = -1;
+    for (size_t f = 0; f < std::min(golden.size(), frameChecksums.size()); ++f)
+        if (golden[f] != frameChecksums[f])
+        {
+            first = first < 0 ? (int)f : first;
+            ++mismatches;
+        }
+    if (mismatches == 0)
+        std::cout << "golden: all " << golden.size() << " frames match" << std::endl;
+    else
+        std::cout << "golden: MISMATCH, " << golden.size() << " golden vs " << frameChecksums.size() << " replayed frames, first differing frame "
+                  << first << std::endl;
+    return mismatches;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -546,11 +1872,27 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    if (!headless)
+    {
+        // the projection and the render resolution follow it from the next frame
+        outputWidth = width;
+        outputHeight = height;
+    }
 }
 
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+{
+    if (inputReplay.active())
+        return; // the replay drives the camera
+    inputRecorder.cursor(xpos, ypos);
+    moveCursor(xpos, ypos);
+}
+
+// mouse look from an absolute cursor position, live or replayed
+// -------------------------------------------------------------
+void moveCursor(double xpos, double ypos)
 {
     if (firstMouse)
     {
@@ -572,74 +1914,114 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    if (inputReplay.active())
+        return;
+    inputRecorder.scroll(xoffset, yoffset);
     camera.ProcessMouseScroll(yoffset);
 }
 
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
+// utility function for loading a 2D texture from file, through the texture cache
+// so the same image is only uploaded once
+// -------------------------------------------------------------------------------
 unsigned int loadTexture(char const* path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+    return textureCache().load(path);
+}
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+// creates the skybox cubemap with 1x1 placeholder faces and queues the real
+// faces on the loader; pumpAssets() uploads them as they are decoded.
+// The same list of faces gives back the cubemap made the first time.
+unsigned int loadCubemap(vector<std::string> faces, AssetLoader& loader)
+{
+    static map<vector<std::string>, unsigned int> loaded;
+    map<vector<std::string>, unsigned int>::iterator it = loaded.find(faces);
+    if (it != loaded.end())
+        return it->second;
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT); // for this tutorial: use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    loaded[faces] = textureID;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-        stbi_image_free(data);
-    }
-    else
+    const unsigned char grey[3] = { 128, 128, 128 };
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned int i = 0; i < faces.size(); i++)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+        loader.loadImage(textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faces[i], 3);
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
     return textureID;
 }
 
-unsigned int loadCubemap(vector<std::string> faces)
+// uploads every asset the loader has finished since the last call (context thread
+// only) and returns how many models were swapped in
+// -------------------------------------------------------------------------------
+unsigned int pumpAssets(AssetLoader& loader, TextureUploader& uploader)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    unsigned int swapped = 0;
+    LoadedModel loaded;
+    while (loader.takeModel(loaded))
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        if (loaded.ok)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            map<std::string, unsigned int> textures;
+            for (const auto& image : loaded.images)
+                textures[image.first] = image.second.ok() ? textureCache().acquire(image.second, loaded.data.directory + '/' + image.first) : placeholderTexture;
+            models[loaded.id].release();
+            models[loaded.id] = RenderModel(loaded.data, textures, quantizedVertices);
+            if (modelOccludes[loaded.id])
+                occluderMeshes[loaded.id] = OccluderMesh(loaded.data);
+            scene.setModelBounds(loaded.id, models[loaded.id].bounds);
+            std::cout << modelPaths[loaded.id] << ": ACMR " << models[loaded.id].sourceAcmr << " -> " << models[loaded.id].acmr
+                      << ", " << sizeof(PackedVertex) << " -> " << models[loaded.id].vertexSize << " bytes/vertex" << std::endl;
+            meshCacheHits += loaded.cacheHit ? 1 : 0;
+            ++swapped;
         }
         else
+            std::cout << "Failed to load model: " << modelPaths[loaded.id] << std::endl;
+        if (++modelsLoaded == MODEL_COUNT)
+            std::cout << "Models loaded in " << (glfwGetTime() - assetLoadStart) * 1000.0 << " ms on " << loader.threads()
+                      << " threads (" << meshCacheHits << "/" << MODEL_COUNT << " from mesh cache, " << textureCache().hits << "/"
+                      << textureCache().hits + textureCache().misses << " textures shared)" << std::endl;
+    }
+    LoadedImage image;
+    while (loader.takeImage(image))
+    {
+        // 2D images are reloads of textures the cache had reduced, the rest are skybox faces
+        if (image.target == GL_TEXTURE_2D)
+            textureCache().restore(image.texture, image.image);
+        else if (image.image.ok())
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            uploader.uploadTarget(image.texture, image.target, GL_TEXTURE_CUBE_MAP, image.image);
+            textureCache().pin((size_t)image.image.width * image.image.height * 4);
         }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return swapped;
+}
 
-    return textureID;
-}
\ No newline at end of file
+// offscreen colour + depth target for headless rendering
+// ------------------------------------------------------
+bool createOffscreenTarget(unsigned int width, unsigned int height, unsigned int& fbo, unsigned int& colorRBO, unsigned int& depthRBO)
+{
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &colorRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+
+    glGenRenderbuffers(1, &depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
@@ -1,6 +1,12 @@
 #version 330 core
 out vec4 FragColor;
 
+#ifdef DEFERRED
+// lighting pass of the deferred path: surface attributes come from the G-buffer
+uniform sampler2D gPosition;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo; // alpha 0 where nothing was drawn
+#else
 in VS_OUT {
     vec3 FragPos;
     vec3 Normal;
@@ -8,26 +14,78 @@ in VS_OUT {
 } fs_in;
 
 uniform sampler2D diffuseTexture;
+#endif
 uniform samplerCube depthMap;
+uniform samplerCube momentsMap; // prefiltered moments, VSM/ESM only
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightStrength;
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform Light
+{
+    mat4 shadowMatrices[6]; // light projection * view per cubemap face
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightStrength;
+    bool shadows;
+    int shadowFilter; // 0 = PCF, 1 = VSM, 2 = ESM
+    float esmExponent;
+    int shadowSamples; // PCF taps, lowered by the quality governor
+};
 
-uniform float far_plane;
-uniform bool shadows;
+#ifdef CLUSTERED_LIGHTS
+// floodlights binned into 16 x 9 x 24 view clusters (see clustered_lights.h)
+uniform samplerBuffer lightData;      // two texels per light: position, radius | colour, shadow slot
+uniform usamplerBuffer clusterRanges; // first index and light count per cluster
+uniform usamplerBuffer clusterLights; // the light indices of every cluster, back to back
+uniform sampler2DShadow shadowAtlas;  // 8 x 8 tiles, six per shadowed light (see shadow_atlas.h)
+uniform vec2 clusterTileScale;        // clusters per pixel in x and y
+uniform vec2 clusterDepth;            // slice = log(view depth) * x + y
+
+layout (std140) uniform ShadowAtlas
+{
+    mat4 atlasMatrices[60]; // light projection * view per face, 6 * MAX_SHADOWED_LIGHTS
+    vec4 atlasLights[10];   // position, radius
+};
+#endif
 
 
-// array of offset direction for sampling
+// array of offset direction for sampling, ordered so that every group of four
+// is balanced around the centre and any prefix of 4, 8, 12 or 16 taps stays unbiased
 vec3 gridSamplingDisk[20] = vec3[]
 (
-   vec3(1, 1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1, 1,  1), 
-   vec3(1, 1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),
-   vec3(1, 1,  0), vec3( 1, -1,  0), vec3(-1, -1,  0), vec3(-1, 1,  0),
-   vec3(1, 0,  1), vec3(-1,  0,  1), vec3( 1,  0, -1), vec3(-1, 0, -1),
-   vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
+   vec3(1, 1,  1), vec3(-1, -1,  1), vec3( 1, -1, -1), vec3(-1,  1, -1),
+   vec3(1, -1, 1), vec3(-1,  1,  1), vec3( 1,  1, -1), vec3(-1, -1, -1),
+   vec3(1, 1,  0), vec3(-1, -1,  0), vec3( 0,  1,  1), vec3( 0, -1, -1),
+   vec3(1, 0,  1), vec3(-1,  0, -1), vec3( 1, -1,  0), vec3(-1,  1,  0),
+   vec3(0, 1, -1), vec3( 0, -1,  1), vec3( 1,  0, -1), vec3(-1,  0,  1)
 );
 
+// Chebyshev upper bound on the lit fraction from the blurred depth moments
+float VarianceShadow(vec3 fragToLight, float depth)
+{
+    vec2 moments = texture(momentsMap, fragToLight).rg;
+    if (depth <= moments.x)
+        return 0.0;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    // cut off the low tail to reduce light bleeding where occluders overlap
+    pMax = clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+    return 1.0 - pMax;
+}
+
+// blurred exp(c * occluder) times exp(-c * receiver) approximates the lit fraction
+float ExponentialShadow(vec3 fragToLight, float depth)
+{
+    float occluder = texture(momentsMap, fragToLight).r;
+    return 1.0 - clamp(occluder * exp(-esmExponent * depth), 0.0, 1.0);
+}
+
 float ShadowCalculation(vec3 fragPos)
 {
     // get vector between fragment position and light position
@@ -37,7 +95,12 @@ float ShadowCalculation(vec3 fragPos)
 
     float shadow = 0.0;
     float bias = 0.15;
-    int samples = 20;
+    // prefiltered maps: one filtered tap instead of the PCF loop below
+    if (shadowFilter == 1)
+        return VarianceShadow(fragToLight, (currentDepth - bias) / far_plane);
+    if (shadowFilter == 2)
+        return ExponentialShadow(fragToLight, (currentDepth - bias) / far_plane);
+    int samples = clamp(shadowSamples, 1, 20);
     float viewDistance = length(viewPos - fragPos);
     float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
     for(int i = 0; i < samples; ++i)
@@ -52,27 +115,88 @@ float ShadowCalculation(vec3 fragPos)
     return shadow;
 }
 
+#ifdef CLUSTERED_LIGHTS
+// lit fraction from the floodlight's tile for the cube face the fragment falls in
+float AtlasShadow(int slot, vec3 fragPos, vec3 lightPos, float radius)
+{
+    vec3 d = fragPos - lightPos;
+    vec3 a = abs(d);
+    int face = a.x >= a.y && a.x >= a.z ? (d.x > 0.0 ? 0 : 1) : a.y >= a.z ? (d.y > 0.0 ? 2 : 3) : (d.z > 0.0 ? 4 : 5);
+    int tile = slot * 6 + face;
+    vec4 clip = atlasMatrices[tile] * vec4(fragPos, 1.0);
+    // stay a texel inside the tile so the bilinear footprint never reads a neighbour
+    float texel = 8.0 / float(textureSize(shadowAtlas, 0).x);
+    vec2 uv = clamp(clip.xy / clip.w * 0.5 + 0.5, vec2(texel), vec2(1.0 - texel));
+    vec2 atlasUV = (vec2(tile % 8, tile / 8) + uv) / 8.0;
+    return texture(shadowAtlas, vec3(atlasUV, (length(d) - 0.05) / radius));
+}
+
+// diffuse + specular of the floodlights in this fragment's cluster only
+vec3 ClusteredLighting(vec3 fragPos, vec3 normal, vec3 viewDir)
+{
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = clamp(int(floor(log(max(viewDepth, 1e-4)) * clusterDepth.x + clusterDepth.y)), 0, 23);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterTileScale), ivec2(0), ivec2(15, 8));
+    uvec2 range = texelFetch(clusterRanges, (slice * 9 + tile.y) * 16 + tile.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int light = int(texelFetch(clusterLights, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, light * 2);
+        vec4 colorSlot = texelFetch(lightData, light * 2 + 1);
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        if (distance >= positionRadius.w)
+            continue;
+        vec3 lightDir = toLight / distance;
+        // inverse square, windowed so it reaches zero at the radius
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+        float diff = max(dot(lightDir, normal), 0.0);
+        float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), 64.0);
+        float lit = colorSlot.w >= 0.0 ? AtlasShadow(int(colorSlot.w), fragPos, positionRadius.xyz, positionRadius.w) : 1.0;
+        result += (diff + spec) * attenuation * lit * colorSlot.rgb;
+    }
+    return result;
+}
+#endif
+
 void main()
 {           
+#ifdef DEFERRED
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 albedo = texelFetch(gAlbedo, texel, 0);
+    if (albedo.a == 0.0)
+        discard; // leave the background for the skybox
+    vec3 color = albedo.rgb;
+    vec3 normal = texelFetch(gNormal, texel, 0).xyz;
+    vec3 fragPos = texelFetch(gPosition, texel, 0).xyz;
+#else
     vec3 color = texture(diffuseTexture, fs_in.TexCoords).rgb;
     vec3 normal = normalize(fs_in.Normal);
+    vec3 fragPos = fs_in.FragPos;
+#endif
     vec3 lightColor = lightStrength;
     // ambient
     vec3 ambient = 0.3 * lightColor;
     // diffuse
-    vec3 lightDir = normalize(lightPos - fs_in.FragPos);
+    vec3 lightDir = normalize(lightPos - fragPos);
     float diff = max(dot(lightDir, normal), 0.0);
     vec3 diffuse = diff * lightColor;
     // specular
-    vec3 viewDir = normalize(viewPos - fs_in.FragPos);
+    vec3 viewDir = normalize(viewPos - fragPos);
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = 0.0;
     vec3 halfwayDir = normalize(lightDir + viewDir);  
     spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
     vec3 specular = spec * lightColor;    
     // calculate shadow
-    float shadow = shadows ? ShadowCalculation(fs_in.FragPos) : 0.0;                      
+    float shadow = shadows ? ShadowCalculation(fragPos) : 0.0;                      
     vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;    
+#ifdef CLUSTERED_LIGHTS
+    lighting += ClusteredLighting(fragPos, normal, viewDir) * color;
+#endif
     
     FragColor = vec4(lighting, 1.0);
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef QUANTIZED_VERTICES
+layout (location = 1) in vec2 aNormal; // octahedral, see mesh_optimize.h
+#else
 layout (location = 1) in vec3 aNormal;
+#endif
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
@@ -11,15 +15,40 @@ out VS_OUT {
     vec2 TexCoords;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
 uniform mat4 model;
+uniform mat3 normalMatrix; // inverse-transpose of model, computed on the CPU
 
+// the depth pre-pass and the shading pass must rasterize identical depths
+invariant gl_Position;
+
+#ifdef QUANTIZED_VERTICES
+// snorm16 positions span the mesh bounds (see mesh_optimize.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+vec3 position() { return positionOffset + positionScale * aPos; }
+vec3 normal()
+{
+    vec3 n = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+#else
+vec3 position() { return aPos; }
+vec3 normal() { return aNormal; }
+#endif
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * aNormal;
+    vs_out.FragPos = vec3(model * vec4(position(), 1.0));
+    vs_out.Normal = normalMatrix * normal();
     vs_out.TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * model * vec4(position(), 1.0);
 }
\ No newline at end of file
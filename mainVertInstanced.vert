@@ -0,0 +1,53 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+#ifdef QUANTIZED_VERTICES
+layout (location = 1) in vec2 aNormal; // octahedral, see mesh_optimize.h
+#else
+layout (location = 1) in vec3 aNormal;
+#endif
+layout (location = 2) in vec2 aTexCoords;
+// per-instance, filled from the model's instance buffer (see render_model.h)
+layout (location = 7) in mat4 aModel;
+layout (location = 11) in mat3 aNormalMatrix;
+
+out VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} vs_out;
+
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+// the depth pre-pass and the shading pass must rasterize identical depths
+invariant gl_Position;
+
+#ifdef QUANTIZED_VERTICES
+// snorm16 positions span the mesh bounds (see mesh_optimize.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+vec3 position() { return positionOffset + positionScale * aPos; }
+vec3 normal()
+{
+    vec3 n = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+#else
+vec3 position() { return aPos; }
+vec3 normal() { return aNormal; }
+#endif
+
+void main()
+{
+    vec4 worldPos = aModel * vec4(position(), 1.0);
+    vs_out.FragPos = vec3(worldPos);
+    vs_out.Normal = aNormalMatrix * normal();
+    vs_out.TexCoords = aTexCoords;
+    gl_Position = projection * view * worldPos;
+}
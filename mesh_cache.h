@@ -0,0 +1,474 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <glm/glm.hpp>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "culling.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// vertex layout of everything the renderer draws: locations 0-2 of the main shaders
+struct PackedVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+};
+
+// Read-only memory mapping of a whole file. Move-only; unmapped on destruction.
+class MappedFile
+{
+public:
+    MappedFile() : data(NULL), size(0) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) : data(other.data), size(other.size) { other.data = NULL; other.size = 0; }
+    MappedFile& operator=(MappedFile&& other)
+    {
+        if (this != &other)
+        {
+            close();
+            data = other.data;
+            size = other.size;
+            other.data = NULL;
+            other.size = 0;
+        }
+        return *this;
+    }
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        CloseHandle(file);
+        if (mapping == NULL)
+            return false;
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        size = data ? (size_t)fileSize.QuadPart : 0;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = (const unsigned char*)mapped;
+        size = (size_t)info.st_size;
+#endif
+        return data != NULL;
+    }
+
+    void close()
+    {
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const unsigned char* bytes() const { return data; }
+    size_t length() const { return size; }
+
+private:
+    const unsigned char* data;
+    size_t size;
+};
+
+// detail levels per mesh, including the full-resolution one
+const unsigned int MESH_MAX_LODS = 4;
+
+// CPU-side copy of one mesh. Either owns its arrays (fresh OBJ import) or
+// points straight into a mapped cache file, in which case nothing is copied
+// before the GL upload. The index array holds every LOD back to back, all
+// indexing the same vertices; LOD 0 is the original triangle list.
+struct MeshData
+{
+    const PackedVertex* mappedVertices = NULL;
+    const unsigned int* mappedIndices = NULL;
+    unsigned int vertexCount = 0;
+    unsigned int indexCount = 0; // over all LODs
+    std::vector<PackedVertex> vertexStorage;
+    std::vector<unsigned int> indexStorage;
+    std::vector<std::string> textures; // relative to the model directory, diffuse first
+    AABB bounds;
+    unsigned int lodCount = 1;
+    unsigned int lodFirst[MESH_MAX_LODS] = { 0 }; // first index of each LOD
+    unsigned int lodIndexCount[MESH_MAX_LODS] = { 0 };
+    float lodError[MESH_MAX_LODS] = { 0.0f }; // model-space distance from the original surface
+    float sourceAcmr = 0.0f; // LOD 0 cache miss ratio in the order the OBJ had, before optimizeMesh()
+
+    const PackedVertex* vertices() const { return mappedVertices ? mappedVertices : vertexStorage.data(); }
+    const unsigned int* indices() const { return mappedIndices ? mappedIndices : indexStorage.data(); }
+};
+
+struct ModelData
+{
+    std::string directory;
+    std::vector<MeshData> meshes;
+    MappedFile mapping; // keeps mapped mesh arrays alive until upload
+};
+
+// On-disk layout of a .meshcache file: header, mesh table, then 16-byte aligned
+// vertex/index arrays and length-prefixed texture paths.
+const char MESH_CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+const uint32_t MESH_CACHE_VERSION = 3; // 2: LOD index ranges, 3: optimised order and source ACMR
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t vertexSize;
+};
+
+struct MeshCacheEntry
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t textureOffset;
+    uint32_t textureCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t lodCount;
+    uint32_t lodFirst[MESH_MAX_LODS];
+    uint32_t lodIndexCount[MESH_MAX_LODS];
+    float lodError[MESH_MAX_LODS];
+    float sourceAcmr;
+};
+
+inline std::string meshCachePath(const std::string& sourcePath)
+{
+    return sourcePath + ".meshcache";
+}
+
+// 0 if the file does not exist
+inline long long fileModifiedTime(const std::string& path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return 0;
+    return (long long)info.st_mtime;
+}
+
+inline bool writeMeshCache(const std::string& path, const ModelData& model)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    MeshCacheHeader header;
+    memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.meshCount = (uint32_t)model.meshes.size();
+    header.vertexSize = sizeof(PackedVertex);
+
+    // lay out the payload after the header and mesh table
+    std::vector<MeshCacheEntry> entries(model.meshes.size());
+    uint64_t offset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry);
+    for (size_t i = 0; i < model.meshes.size(); ++i)
+    {
+        const MeshData& mesh = model.meshes[i];
+        MeshCacheEntry& entry = entries[i];
+        entry.vertexCount = mesh.vertexCount;
+        entry.indexCount = mesh.indexCount;
+        entry.textureCount = (uint32_t)mesh.textures.size();
+        entry.lodCount = mesh.lodCount;
+        entry.sourceAcmr = mesh.sourceAcmr;
+        for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+        {
+            entry.lodFirst[l] = mesh.lodFirst[l];
+            entry.lodIndexCount[l] = mesh.lodIndexCount[l];
+            entry.lodError[l] = mesh.lodError[l];
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            entry.boundsMin[c] = mesh.bounds.min[c];
+            entry.boundsMax[c] = mesh.bounds.max[c];
+        }
+        offset = (offset + 15) & ~uint64_t(15);
+        entry.vertexOffset = offset;
+        offset += (uint64_t)mesh.vertexCount * sizeof(PackedVertex);
+        offset = (offset + 15) & ~uint64_t(15);
+        entry.indexOffset = offset;
+        offset += (uint64_t)mesh.indexCount * sizeof(unsigned int);
+        entry.textureOffset = offset;
+        for (const std::string& texture : mesh.textures)
+            offset += sizeof(uint32_t) + texture.size();
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!entries.empty())
+        ok = ok && fwrite(entries.data(), sizeof(MeshCacheEntry), entries.size(), file) == entries.size();
+    static const char padding[16] = { 0 };
+    for (size_t i = 0; ok && i < model.meshes.size(); ++i)
+    {
+        const MeshData& mesh = model.meshes[i];
+        const MeshCacheEntry& entry = entries[i];
+        long position = ftell(file);
+        ok = ok && fwrite(padding, 1, (size_t)(entry.vertexOffset - position), file) == (size_t)(entry.vertexOffset - position);
+        ok = ok && fwrite(mesh.vertices(), sizeof(PackedVertex), mesh.vertexCount, file) == mesh.vertexCount;
+        position = ftell(file);
+        ok = ok && fwrite(padding, 1, (size_t)(entry.indexOffset - position), file) == (size_t)(entry.indexOffset - position);
+        ok = ok && fwrite(mesh.indices(), sizeof(unsigned int), mesh.indexCount, file) == mesh.indexCount;
+        for (const std::string& texture : mesh.textures)
+        {
+            uint32_t length = (uint32_t)texture.size();
+            ok = ok && fwrite(&length, sizeof(length), 1, file) == 1;
+            ok = ok && fwrite(texture.data(), 1, length, file) == length;
+        }
+    }
+    fclose(file);
+    if (!ok)
+        remove(path.c_str());
+    return ok;
+}
+
+// maps a cache file and points every mesh at its arrays inside the mapping
+inline bool readMeshCache(const std::string& path, ModelData& model)
+{
+    MappedFile mapping;
+    if (!mapping.open(path) || mapping.length() < sizeof(MeshCacheHeader))
+        return false;
+    const unsigned char* base = mapping.bytes();
+    size_t size = mapping.length();
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION || header->vertexSize != sizeof(PackedVertex))
+        return false;
+    if (sizeof(MeshCacheHeader) + (size_t)header->meshCount * sizeof(MeshCacheEntry) > size)
+        return false;
+
+    const MeshCacheEntry* entries = (const MeshCacheEntry*)(base + sizeof(MeshCacheHeader));
+    model.meshes.clear();
+    model.meshes.resize(header->meshCount);
+    for (uint32_t i = 0; i < header->meshCount; ++i)
+    {
+        const MeshCacheEntry& entry = entries[i];
+        if (entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(PackedVertex) > size ||
+            entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int) > size)
+            return false;
+        MeshData& mesh = model.meshes[i];
+        mesh.mappedVertices = (const PackedVertex*)(base + entry.vertexOffset);
+        mesh.mappedIndices = (const unsigned int*)(base + entry.indexOffset);
+        mesh.vertexCount = entry.vertexCount;
+        mesh.indexCount = entry.indexCount;
+        if (entry.lodCount < 1 || entry.lodCount > MESH_MAX_LODS)
+            return false;
+        mesh.lodCount = entry.lodCount;
+        mesh.sourceAcmr = entry.sourceAcmr;
+        for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+        {
+            if (l < entry.lodCount && entry.lodFirst[l] + entry.lodIndexCount[l] > entry.indexCount)
+                return false;
+            mesh.lodFirst[l] = entry.lodFirst[l];
+            mesh.lodIndexCount[l] = entry.lodIndexCount[l];
+            mesh.lodError[l] = entry.lodError[l];
+        }
+        mesh.bounds = AABB(glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]),
+                           glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]));
+        uint64_t offset = entry.textureOffset;
+        for (uint32_t t = 0; t < entry.textureCount; ++t)
+        {
+            uint32_t length;
+            if (offset + sizeof(length) > size)
+                return false;
+            memcpy(&length, base + offset, sizeof(length));
+            offset += sizeof(length);
+            if (offset + length > size)
+                return false;
+            mesh.textures.push_back(std::string((const char*)base + offset, length));
+            offset += length;
+        }
+    }
+    model.mapping = std::move(mapping);
+    return true;
+}
+
+// Appends simplified LODs at 1/2, 1/4 and 1/10 of the triangles to an owned mesh.
+// Stops early when a level would not drop at least a fifth of the previous one
+// (small or fully locked meshes), so lodCount may stay below MESH_MAX_LODS.
+inline void generateLods(MeshData& mesh)
+{
+    static const float ratios[MESH_MAX_LODS] = { 1.0f, 0.5f, 0.25f, 0.1f };
+    const unsigned int minimumTriangles = 64;
+    mesh.lodCount = 1;
+    mesh.lodFirst[0] = 0;
+    mesh.lodIndexCount[0] = mesh.indexCount;
+    mesh.lodError[0] = 0.0f;
+    if (mesh.vertexStorage.empty() || mesh.indexCount / 3 < minimumTriangles)
+        return;
+
+    std::vector<unsigned int> base(mesh.indexStorage.begin(), mesh.indexStorage.begin() + mesh.indexCount);
+    for (unsigned int l = 1; l < MESH_MAX_LODS; ++l)
+    {
+        unsigned int target = ((unsigned int)(base.size() * ratios[l]) / 3) * 3;
+        float error = 0.0f;
+        std::vector<unsigned int> lod = simplifyMesh((const unsigned char*)&mesh.vertexStorage[0].position, sizeof(PackedVertex), mesh.vertexCount,
+                                                     base.data(), (unsigned int)base.size(), target, error);
+        if (lod.empty() || lod.size() > mesh.lodIndexCount[l - 1] * 4 / 5)
+            break;
+        mesh.lodFirst[l] = (unsigned int)mesh.indexStorage.size();
+        mesh.lodIndexCount[l] = (unsigned int)lod.size();
+        mesh.lodError[l] = std::max(error, mesh.lodError[l - 1]);
+        mesh.indexStorage.insert(mesh.indexStorage.end(), lod.begin(), lod.end());
+        mesh.lodCount = l + 1;
+    }
+    mesh.indexCount = (unsigned int)mesh.indexStorage.size();
+}
+
+// Reorders an owned mesh for the GPU: each LOD's triangles for the post-transform
+// cache and then for overdraw, and finally the vertices in order of first use,
+// LOD 0 first, so fetches stream through the vertex buffer.
+inline void optimizeMesh(MeshData& mesh)
+{
+    if (mesh.vertexStorage.empty() || mesh.indexCount == 0)
+        return;
+    mesh.sourceAcmr = analyzeVertexCache(mesh.indexStorage.data(), mesh.lodIndexCount[0], mesh.vertexCount);
+    for (unsigned int l = 0; l < mesh.lodCount; ++l)
+    {
+        unsigned int* indices = mesh.indexStorage.data() + mesh.lodFirst[l];
+        optimizeVertexCache(indices, mesh.lodIndexCount[l], mesh.vertexCount);
+        optimizeOverdraw(indices, mesh.lodIndexCount[l], (const unsigned char*)&mesh.vertexStorage[0].position, sizeof(PackedVertex), mesh.vertexCount);
+    }
+    mesh.vertexCount = optimizeVertexFetch(mesh.vertexStorage, mesh.indexStorage.data(), mesh.indexCount);
+}
+
+// Assimp import into owned MeshData, same flags and texture order as learnopengl's Model
+inline void importMaterialTextures(aiMaterial* material, aiTextureType type, std::vector<std::string>& textures)
+{
+    for (unsigned int i = 0; i < material->GetTextureCount(type); ++i)
+    {
+        aiString path;
+        material->GetTexture(type, i, &path);
+        std::string texture = path.C_Str();
+        bool seen = false;
+        for (const std::string& existing : textures)
+            seen = seen || existing == texture;
+        if (!seen)
+            textures.push_back(texture);
+    }
+}
+
+inline void importNode(const aiScene* scene, aiNode* node, ModelData& model)
+{
+    for (unsigned int n = 0; n < node->mNumMeshes; ++n)
+    {
+        aiMesh* source = scene->mMeshes[node->mMeshes[n]];
+        model.meshes.push_back(MeshData());
+        MeshData& mesh = model.meshes.back();
+
+        mesh.vertexStorage.resize(source->mNumVertices);
+        for (unsigned int i = 0; i < source->mNumVertices; ++i)
+        {
+            PackedVertex& vertex = mesh.vertexStorage[i];
+            vertex.position = glm::vec3(source->mVertices[i].x, source->mVertices[i].y, source->mVertices[i].z);
+            vertex.normal = source->HasNormals() ? glm::vec3(source->mNormals[i].x, source->mNormals[i].y, source->mNormals[i].z) : glm::vec3(0.0f);
+            vertex.texCoords = source->mTextureCoords[0] ? glm::vec2(source->mTextureCoords[0][i].x, source->mTextureCoords[0][i].y) : glm::vec2(0.0f);
+            mesh.bounds.expand(vertex.position);
+        }
+        for (unsigned int f = 0; f < source->mNumFaces; ++f)
+            for (unsigned int j = 0; j < source->mFaces[f].mNumIndices; ++j)
+                mesh.indexStorage.push_back(source->mFaces[f].mIndices[j]);
+        mesh.vertexCount = (unsigned int)mesh.vertexStorage.size();
+        mesh.indexCount = (unsigned int)mesh.indexStorage.size();
+        mesh.lodIndexCount[0] = mesh.indexCount;
+
+        aiMaterial* material = scene->mMaterials[source->mMaterialIndex];
+        importMaterialTextures(material, aiTextureType_DIFFUSE, mesh.textures);
+        importMaterialTextures(material, aiTextureType_SPECULAR, mesh.textures);
+        importMaterialTextures(material, aiTextureType_HEIGHT, mesh.textures);
+        importMaterialTextures(material, aiTextureType_AMBIENT, mesh.textures);
+    }
+    for (unsigned int c = 0; c < node->mNumChildren; ++c)
+        importNode(scene, node->mChildren[c], model);
+}
+
+inline bool importObj(const std::string& path, ModelData& model)
+{
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+        return false;
+    }
+    model.meshes.clear();
+    importNode(scene, scene->mRootNode, model);
+    for (MeshData& mesh : model.meshes)
+    {
+        generateLods(mesh);
+        optimizeMesh(mesh);
+    }
+    return true;
+}
+
+// Loads a model through its binary cache. The OBJ is parsed only when the
+// cache is missing, unreadable or older than the source, and the cache is
+// rewritten afterwards.
+inline bool loadModelData(const std::string& path, ModelData& model, bool* cacheHit = NULL)
+{
+    model.directory = path.substr(0, path.find_last_of('/'));
+    std::string cache = meshCachePath(path);
+    long long cacheTime = fileModifiedTime(cache);
+    if (cacheTime != 0 && cacheTime >= fileModifiedTime(path) && readMeshCache(cache, model))
+    {
+        if (cacheHit)
+            *cacheHit = true;
+        return true;
+    }
+    if (cacheHit)
+        *cacheHit = false;
+    if (!importObj(path, model))
+        return false;
+    if (!writeMeshCache(cache, model))
+        std::cout << "Failed to write mesh cache: " << cache << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// FIFO size used to estimate post-transform cache behaviour; close to what current GPUs reuse
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// average cache misses per triangle (ACMR) of an index list through a FIFO
+// cache: 3 is no reuse at all, ~0.5-0.7 is the practical optimum
+inline float analyzeVertexCache(const unsigned int* indices, unsigned int indexCount, unsigned int vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    if (indexCount < 3)
+        return 0.0f;
+    std::vector<unsigned int> insertedAt(vertexCount, 0); // miss counter value when the vertex entered the cache, +1
+    unsigned int misses = 0;
+    for (unsigned int i = 0; i < indexCount; ++i)
+    {
+        unsigned int v = indices[i];
+        if (insertedAt[v] == 0 || misses + 1 - insertedAt[v] > cacheSize)
+            insertedAt[v] = ++misses;
+    }
+    return (float)misses / (indexCount / 3);
+}
+
+// Reorders triangles for post-transform cache reuse (Forsyth, "Linear-speed vertex
+// cache optimisation"): greedily emits the triangle whose vertices score best,
+// favouring recently used vertices and ones with few triangles left.
+inline void optimizeVertexCache(unsigned int* indices, unsigned int indexCount, unsigned int vertexCount)
+{
+    const int cacheSize = 32; // modelled LRU size for scoring, larger than the real FIFO on purpose
+    unsigned int triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    // vertex -> triangles using it
+    std::vector<unsigned int> first(vertexCount + 1, 0), adjacency(indexCount);
+    for (unsigned int i = 0; i < indexCount; ++i)
+        ++first[indices[i] + 1];
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        first[v + 1] += first[v];
+    std::vector<unsigned int> remaining(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        remaining[v] = first[v + 1] - first[v];
+    {
+        std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+        for (unsigned int i = 0; i < indexCount; ++i)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](unsigned int v)
+    {
+        if (remaining[v] == 0)
+            return -1.0f;
+        float score = 0.0f;
+        int position = cachePosition[v];
+        if (position >= 0)
+            score = position < 3 ? 0.75f : std::pow(1.0f - (position - 3) / float(cacheSize - 3), 1.5f);
+        return score + 2.0f / std::sqrt((float)remaining[v]);
+    };
+    std::vector<float> score(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        score[v] = vertexScore(v);
+    std::vector<float> triangleScore(triangleCount);
+    for (unsigned int t = 0; t < triangleCount; ++t)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    std::vector<unsigned char> emitted(triangleCount, 0);
+    std::vector<unsigned int> output;
+    output.reserve(indexCount);
+    std::vector<unsigned int> cache, nextCache;
+    unsigned int scan = 0; // fallback search position when the cache offers nothing
+    int best = -1;
+    for (unsigned int done = 0; done < triangleCount; ++done)
+    {
+        if (best < 0)
+        {
+            float bestScore = -1.0f;
+            for (unsigned int t = 0; t < triangleCount; ++t)
+                if (!emitted[t] && triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = (int)t;
+                }
+        }
+        unsigned int t = (unsigned int)best;
+        emitted[t] = 1;
+        const unsigned int* tri = indices + t * 3;
+        output.insert(output.end(), tri, tri + 3);
+
+        // the triangle's vertices move to the front of the modelled cache
+        nextCache.assign(tri, tri + 3);
+        for (unsigned int v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                nextCache.push_back(v);
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int v = tri[k];
+            for (unsigned int a = first[v]; a < first[v] + remaining[v]; ++a)
+                if (adjacency[a] == t)
+                {
+                    std::swap(adjacency[a], adjacency[first[v] + remaining[v] - 1]);
+                    --remaining[v];
+                    break;
+                }
+        }
+        for (unsigned int k = 0; k < nextCache.size(); ++k)
+            cachePosition[nextCache[k]] = k < (unsigned int)cacheSize ? (int)k : -1;
+        if (nextCache.size() > (size_t)cacheSize)
+            nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+
+        // rescore the cached vertices and the triangles around them, and pick the next one there
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache)
+            score[v] = vertexScore(v);
+        for (unsigned int v : cache)
+            for (unsigned int a = first[v]; a < first[v] + remaining[v]; ++a)
+            {
+                unsigned int u = adjacency[a];
+                triangleScore[u] = score[indices[u * 3]] + score[indices[u * 3 + 1]] + score[indices[u * 3 + 2]];
+                if (triangleScore[u] > bestScore)
+                {
+                    bestScore = triangleScore[u];
+                    best = (int)u;
+                }
+            }
+        // nothing adjacent left: continue with the next unemitted triangle in input order
+        if (best < 0)
+        {
+            while (scan < triangleCount && emitted[scan])
+                ++scan;
+            best = scan < triangleCount ? (int)scan : -1;
+        }
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Reorders clusters of a cache-optimised triangle list so that outward-facing
+// clusters, which tend to occlude the rest of the mesh, are drawn first (after
+// Sander et al., "Fast triangle reordering for vertex locality and reduced
+// overdraw"). Clusters end where the cache restarts (a triangle missing on all
+// three vertices) or, once a cluster's own miss ratio is within threshold of the
+// whole mesh's, at the next miss; so cache reuse degrades by at most threshold.
+inline void optimizeOverdraw(unsigned int* indices, unsigned int indexCount, const unsigned char* positions, size_t stride, unsigned int vertexCount,
+                             float threshold = 1.05f)
+{
+    unsigned int triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+    auto position = [&](unsigned int v) { return *(const glm::vec3*)(positions + v * stride); };
+
+    std::vector<unsigned int> clusterStart;
+    {
+        // the cache is treated as flushed at every cluster start, as the reordered clusters will see it
+        float limit = analyzeVertexCache(indices, indexCount, vertexCount) * threshold;
+        std::vector<unsigned int> insertedAt(vertexCount, 0);
+        unsigned int misses = 0, clusterBase = 0, clusterMisses = 0;
+        auto cached = [&](unsigned int v) { return insertedAt[v] > clusterBase && misses + 1 - insertedAt[v] <= VERTEX_CACHE_SIZE; };
+        for (unsigned int t = 0; t < triangleCount; ++t)
+        {
+            const unsigned int* tri = indices + t * 3;
+            int triangleMisses = !cached(tri[0]) + !cached(tri[1]) + !cached(tri[2]);
+            if (t == 0 || triangleMisses == 3 ||
+                (triangleMisses > 0 && clusterMisses <= limit * (t - clusterStart.back())))
+            {
+                clusterStart.push_back(t);
+                clusterBase = misses;
+                clusterMisses = 0;
+            }
+            for (int k = 0; k < 3; ++k)
+                if (!cached(tri[k]))
+                {
+                    insertedAt[tri[k]] = ++misses;
+                    ++clusterMisses;
+                }
+        }
+        clusterStart.push_back(triangleCount);
+    }
+    unsigned int clusterCount = (unsigned int)clusterStart.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centroid(clusterCount, glm::vec3(0.0f)), normal(clusterCount, glm::vec3(0.0f));
+    std::vector<float> area(clusterCount, 0.0f);
+    for (unsigned int c = 0; c < clusterCount; ++c)
+        for (unsigned int t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+        {
+            glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float a = glm::length(n);
+            centroid[c] += (p0 + p1 + p2) * (a / 3.0f);
+            normal[c] += n;
+            area[c] += a;
+        }
+    for (unsigned int c = 0; c < clusterCount; ++c)
+    {
+        meshCentroid += centroid[c];
+        meshArea += area[c];
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+    // occlusion potential: how far the cluster sits out from the centre along its own normal
+    std::vector<float> sortKey(clusterCount);
+    std::vector<unsigned int> order(clusterCount);
+    for (unsigned int c = 0; c < clusterCount; ++c)
+    {
+        glm::vec3 center = area[c] > 0.0f ? centroid[c] / area[c] : meshCentroid;
+        float length = glm::length(normal[c]);
+        sortKey[c] = length > 0.0f ? glm::dot(center - meshCentroid, normal[c] / length) : 0.0f;
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<unsigned int> output;
+    output.reserve(indexCount);
+    for (unsigned int c : order)
+        output.insert(output.end(), indices + clusterStart[c] * 3, indices + clusterStart[c + 1] * 3);
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Renumbers vertices in order of first use so vertex fetches walk the buffer
+// forwards; unused vertices are dropped. Returns the new vertex count.
+template <typename Vertex>
+inline unsigned int optimizeVertexFetch(std::vector<Vertex>& vertices, unsigned int* indices, unsigned int indexCount)
+{
+    std::vector<unsigned int> remap(vertices.size(), ~0u);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (unsigned int i = 0; i < indexCount; ++i)
+    {
+        unsigned int& target = remap[indices[i]];
+        if (target == ~0u)
+        {
+            target = (unsigned int)reordered.size();
+            reordered.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+    vertices.swap(reordered);
+    return (unsigned int)vertices.size();
+}
+
+// IEEE half from float, rounding to nearest; denormals flush to zero, which is
+// fine for texture coordinates
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return (uint16_t)(sign | 0x7C00u | (mantissa ? 0x200u : 0u)); // inf / nan
+    if (exponent <= 0)
+        return (uint16_t)sign;
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7C00u);
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    if ((mantissa & 0x1FFFu) > 0x1000u || ((mantissa & 0x1FFFu) == 0x1000u && (half & 1u)))
+        ++half; // may carry into the exponent, which is still the right rounding
+    return (uint16_t)half;
+}
+
+inline int16_t floatToSnorm16(float value)
+{
+    value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+    return (int16_t)std::lround(value * 32767.0f);
+}
+
+// unit vector -> octahedral map in [-1, 1]^2 (Cigolle et al.)
+inline glm::vec2 octahedralEncode(glm::vec3 n)
+{
+    float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (sum <= 0.0f)
+        return glm::vec2(0.0f, 0.0f);
+    n = n / sum;
+    if (n.z >= 0.0f)
+        return glm::vec2(n.x, n.y);
+    return glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                     (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+// 16-byte vertex for the QUANTIZED_VERTICES shader variants: position as snorm16
+// inside the mesh bounds (the shader adds positionOffset + positionScale * p),
+// octahedral snorm16 normal and half-float texture coordinates
+struct QuantizedVertex
+{
+    int16_t position[4]; // w unused, keeps the attribute 8-byte aligned
+    int16_t normal[2];
+    uint16_t texCoords[2];
+};
+
+// center and extent are the mesh bounds' center and half size, extent nonzero on every axis
+inline QuantizedVertex quantizeVertex(glm::vec3 position, glm::vec3 normal, glm::vec2 texCoords, glm::vec3 center, glm::vec3 extent)
+{
+    QuantizedVertex vertex;
+    glm::vec3 p = (position - center) / extent;
+    float length = glm::length(normal);
+    glm::vec2 n = octahedralEncode(length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f));
+    vertex.position[0] = floatToSnorm16(p.x);
+    vertex.position[1] = floatToSnorm16(p.y);
+    vertex.position[2] = floatToSnorm16(p.z);
+    vertex.position[3] = 0;
+    vertex.normal[0] = floatToSnorm16(n.x);
+    vertex.normal[1] = floatToSnorm16(n.y);
+    vertex.texCoords[0] = floatToHalf(texCoords.x);
+    vertex.texCoords[1] = floatToHalf(texCoords.y);
+    return vertex;
+}
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Symmetric 4x4 error quadric (Garland & Heckbert) plus the summed weight of the
+// planes in it, so the error can be turned back into an average distance.
+struct Quadric
+{
+    double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+    double weight;
+
+    Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {}
+
+    // plane n.x + d = 0 with unit normal n
+    Quadric(glm::dvec3 n, double d, double w)
+        : a00(w * n.x * n.x), a01(w * n.x * n.y), a02(w * n.x * n.z), a03(w * n.x * d),
+          a11(w * n.y * n.y), a12(w * n.y * n.z), a13(w * n.y * d),
+          a22(w * n.z * n.z), a23(w * n.z * d), a33(w * d * d), weight(w) {}
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23; a33 += q.a33;
+        weight += q.weight;
+        return *this;
+    }
+
+    // weighted sum of squared distances from p to the planes
+    double error(glm::dvec3 p) const
+    {
+        double e = a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x
+                 + a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y
+                 + a22 * p.z * p.z + 2 * a23 * p.z + a33;
+        return e > 0.0 ? e : 0.0;
+    }
+};
+
+// Reduces an indexed triangle list to about targetIndexCount indices by edge
+// collapses ordered by quadric error. Vertices are never moved or created: an
+// edge collapses onto one of its endpoints, so the result indexes the original
+// vertex buffer and every LOD can share it. Vertices split only by attributes
+// (UV seams, hard normals) are welded for the topology and collapse together:
+// a vertex only collapses when each of its wedges shares an edge of a collapsing
+// triangle with exactly one wedge of the target, and then follows that wedge, so
+// no wedge lands on another seam or UV island. Open borders are locked, and
+// collapses that would flip a neighbouring triangle are skipped.
+//
+// positions points at the first vertex position, stride bytes apart.
+// error receives the largest collapse error as a model-space distance.
+inline std::vector<unsigned int> simplifyMesh(const unsigned char* positions, size_t stride,
+                                              unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+                                              unsigned int targetIndexCount, float& error)
+{
+    auto position = [&](unsigned int v) { return glm::dvec3(*(const glm::vec3*)(positions + v * stride)); };
+    error = 0.0f;
+
+    // weld wedges that share a position onto one canonical vertex
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    std::unordered_map<glm::vec3, unsigned int, PositionHash> welded;
+    std::vector<unsigned int> canonical(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        canonical[v] = welded.insert(std::make_pair(*(const glm::vec3*)(positions + v * stride), v)).first->second;
+
+    // wedges of each canonical vertex
+    std::vector<unsigned int> wedgeFirst(vertexCount + 1, 0), wedges(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        ++wedgeFirst[canonical[v] + 1];
+    for (unsigned int v = 0; v < vertexCount; ++v)
+        wedgeFirst[v + 1] += wedgeFirst[v];
+    {
+        std::vector<unsigned int> fill(wedgeFirst.begin(), wedgeFirst.end() - 1);
+        for (unsigned int v = 0; v < vertexCount; ++v)
+            wedges[fill[canonical[v]]++] = v;
+    }
+
+    std::vector<unsigned int> result(indices, indices + indexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    for (unsigned int t = 0; t + 2 < indexCount; t += 3)
+    {
+        glm::dvec3 p0 = position(indices[t]), p1 = position(indices[t + 1]), p2 = position(indices[t + 2]);
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        double area = glm::length(n);
+        if (area <= 0.0)
+            continue;
+        n /= area;
+        Quadric q(n, -glm::dot(n, p0), area * 0.5);
+        quadrics[canonical[indices[t]]] += q;
+        quadrics[canonical[indices[t + 1]]] += q;
+        quadrics[canonical[indices[t + 2]]] += q;
+    }
+
+    // edges used by a single triangle are open borders; their ends stay put
+    std::vector<unsigned char> locked(vertexCount, 0);
+    {
+        std::unordered_map<uint64_t, int> edgeUses;
+        for (unsigned int t = 0; t + 2 < indexCount; t += 3)
+            for (int e = 0; e < 3; ++e)
+            {
+                unsigned int a = canonical[indices[t + e]], b = canonical[indices[t + (e + 1) % 3]];
+                ++edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)];
+            }
+        for (const std::pair<const uint64_t, int>& edge : edgeUses)
+            if (edge.second == 1)
+                locked[edge.first >> 32] = locked[edge.first & 0xFFFFFFFFu] = 1;
+    }
+
+    struct Collapse
+    {
+        double cost;
+        unsigned int from, to; // canonical vertices
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> triangleFirst, triangleList;
+    std::vector<unsigned int> collapseTo(vertexCount), wedgeTarget(vertexCount);
+    std::vector<unsigned int> partner(vertexCount, ~0u);
+    std::vector<unsigned char> touched(vertexCount);
+    double maxCost = 0.0;
+
+    // true when every wedge of `from` still in use shares a collapsing triangle with
+    // exactly one wedge of `to`; with record set, those wedges go to wedgeTarget
+    auto wedgesMatch = [&](unsigned int from, unsigned int to, bool record)
+    {
+        bool match = true;
+        for (unsigned int k = triangleFirst[from]; k < triangleFirst[from + 1] && match; ++k)
+        {
+            unsigned int t = triangleList[k], wedgeFrom = ~0u, wedgeTo = ~0u;
+            for (int j = 0; j < 3; ++j)
+            {
+                unsigned int w = result[t * 3 + j];
+                if (canonical[w] == from)
+                    wedgeFrom = w;
+                else if (canonical[w] == to)
+                    wedgeTo = w;
+            }
+            if (wedgeTo == ~0u)
+                continue;
+            if (partner[wedgeFrom] == ~0u)
+                partner[wedgeFrom] = wedgeTo;
+            else
+                match = partner[wedgeFrom] == wedgeTo;
+        }
+        for (unsigned int k = triangleFirst[from]; k < triangleFirst[from + 1] && match; ++k)
+            for (int j = 0; j < 3; ++j)
+            {
+                unsigned int w = result[triangleList[k] * 3 + j];
+                if (canonical[w] == from && partner[w] == ~0u)
+                    match = false;
+            }
+        for (unsigned int v = wedgeFirst[from]; v < wedgeFirst[from + 1]; ++v)
+        {
+            unsigned int w = wedges[v];
+            if (record && partner[w] != ~0u)
+                wedgeTarget[w] = partner[w];
+            partner[w] = ~0u;
+        }
+        return match;
+    };
+
+    // each pass collapses a batch of independent edges, cheapest first, then rebuilds the triangle list
+    while (result.size() > targetIndexCount)
+    {
+        unsigned int triangleCount = (unsigned int)result.size() / 3;
+
+        // canonical vertex -> triangles around it
+        triangleFirst.assign(vertexCount + 1, 0);
+        for (unsigned int i = 0; i < result.size(); ++i)
+            ++triangleFirst[canonical[result[i]] + 1];
+        for (unsigned int v = 0; v < vertexCount; ++v)
+            triangleFirst[v + 1] += triangleFirst[v];
+        triangleList.resize(result.size());
+        {
+            std::vector<unsigned int> fill(triangleFirst.begin(), triangleFirst.end() - 1);
+            for (unsigned int i = 0; i < result.size(); ++i)
+                triangleList[fill[canonical[result[i]]]++] = i / 3;
+        }
+
+        // cheaper direction of every edge, skipping locked sources and seam vertices
+        // whose wedges do not each meet one wedge at the other end
+        collapses.clear();
+        for (unsigned int t = 0; t < triangleCount; ++t)
+            for (int e = 0; e < 3; ++e)
+            {
+                unsigned int a = canonical[result[t * 3 + e]], b = canonical[result[t * 3 + (e + 1) % 3]];
+                if (a > b)
+                    continue; // each interior edge is seen from both sides; take it once
+                Quadric q = quadrics[a];
+                q += quadrics[b];
+                bool aToB = !locked[a] && wedgesMatch(a, b, false);
+                bool bToA = !locked[b] && wedgesMatch(b, a, false);
+                double costAtB = q.error(position(b)), costAtA = q.error(position(a));
+                if (aToB && (!bToA || costAtB <= costAtA))
+                    collapses.push_back({ costAtB, a, b });
+                else if (bToA)
+                    collapses.push_back({ costAtA, b, a });
+            }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        // about two triangles go per collapse; stop a little short so the target is not overshot much
+        unsigned int wanted = std::max(1u, (triangleCount - targetIndexCount / 3) / 2);
+        for (unsigned int v = 0; v < vertexCount; ++v)
+            collapseTo[v] = wedgeTarget[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+        unsigned int done = 0;
+        for (const Collapse& c : collapses)
+        {
+            if (done >= wanted)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // moving `from` onto `to` must not turn any remaining triangle over
+            bool flips = false;
+            glm::dvec3 target = position(c.to);
+            for (unsigned int k = triangleFirst[c.from]; k < triangleFirst[c.from + 1] && !flips; ++k)
+            {
+                unsigned int t = triangleList[k];
+                unsigned int v[3] = { canonical[result[t * 3]], canonical[result[t * 3 + 1]], canonical[result[t * 3 + 2]] };
+                if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+                    continue; // collapses away
+                glm::dvec3 p[3], q[3];
+                for (int j = 0; j < 3; ++j)
+                {
+                    p[j] = position(v[j]);
+                    q[j] = v[j] == c.from ? target : p[j];
+                }
+                glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= 0.25 * glm::length(before) * glm::length(after);
+            }
+            if (flips)
+                continue;
+
+            collapseTo[c.from] = c.to;
+            wedgesMatch(c.from, c.to, true);
+            // the neighbourhood changed, so no other collapse in this pass may use it
+            for (unsigned int k = triangleFirst[c.from]; k < triangleFirst[c.from + 1]; ++k)
+                for (int j = 0; j < 3; ++j)
+                    touched[canonical[result[triangleList[k] * 3 + j]]] = 1;
+            quadrics[c.to] += quadrics[c.from];
+            maxCost = std::max(maxCost, c.cost / std::max(quadrics[c.to].weight, 1e-12));
+            ++done;
+        }
+        if (done == 0)
+            break;
+
+        // every wedge of a collapsed vertex moves to the target wedge it shares an edge with
+        unsigned int kept = 0;
+        for (unsigned int t = 0; t < triangleCount; ++t)
+        {
+            unsigned int v0 = wedgeTarget[result[t * 3]], v1 = wedgeTarget[result[t * 3 + 1]], v2 = wedgeTarget[result[t * 3 + 2]];
+            unsigned int c0 = canonical[v0], c1 = canonical[v1], c2 = canonical[v2];
+            if (c0 == c1 || c1 == c2 || c0 == c2)
+                continue;
+            result[kept++] = v0;
+            result[kept++] = v1;
+            result[kept++] = v2;
+        }
+        result.resize(kept);
+    }
+    error = (float)std::sqrt(maxCost);
+    return result;
+}
+
+#endif
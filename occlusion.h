@@ -0,0 +1,215 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Positions and triangles of a model that hides things well (grandstands, car
+// bodies), kept on the CPU for the occlusion buffer. Always the full-detail LOD 0:
+// the simplified LODs are not guaranteed to stay inside the real surface, and an
+// occluder that sticks out past it would hide objects that are in plain view.
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+
+    OccluderMesh() {}
+
+    explicit OccluderMesh(const ModelData& data)
+    {
+        for (const MeshData& mesh : data.meshes)
+        {
+            unsigned int base = (unsigned int)positions.size();
+            const PackedVertex* vertices = mesh.vertices();
+            for (unsigned int v = 0; v < mesh.vertexCount; ++v)
+                positions.push_back(vertices[v].position);
+            const unsigned int* source = mesh.indices() + mesh.lodFirst[0];
+            for (unsigned int i = 0; i < mesh.lodIndexCount[0]; ++i)
+                indices.push_back(base + source[i]);
+        }
+    }
+
+    bool empty() const { return indices.empty(); }
+    unsigned int triangles() const { return (unsigned int)indices.size() / 3; }
+};
+
+// Software Hi-Z occlusion culling. The occluders of a view are rasterized on the
+// CPU into a small depth buffer (NDC depth, nearest wins), which is reduced into a
+// pyramid where each texel keeps the farthest depth of the four below it. An
+// object is hidden when the nearest corner of its bounds is behind the farthest
+// occluder depth over its whole screen rectangle, read from the level where that
+// rectangle covers at most 2x2 texels.
+// It errs towards drawing: occluder triangles that cross the near plane are
+// skipped, boxes that reach behind the camera are always visible, and every
+// rectangle is grown by a texel so coverage sampled at texel centres cannot hide
+// something peeking past an occluder's edge. The buffer is built for the same
+// view in the same frame, so nothing pops when the camera turns.
+class OcclusionBuffer
+{
+public:
+    static const int WIDTH = 256, HEIGHT = 144;
+    static constexpr float NEAR_W = 1e-3f; // clip w under which a vertex counts as behind the eye
+    static constexpr float DEPTH_BIAS = 1e-4f; // NDC depth an object must be behind by
+
+    // of the current view
+    unsigned int occluderTriangles;
+
+    OcclusionBuffer() : occluderTriangles(0)
+    {
+        int w = WIDTH, h = HEIGHT;
+        for (;;)
+        {
+            levels.push_back(Level{ w, h, std::vector<float>((size_t)w * h, 1.0f) });
+            if (w == 1 && h == 1)
+                break;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+    }
+
+    // starts a view: clears the depth to the far plane
+    void begin(const glm::mat4& viewProjection)
+    {
+        this->viewProjection = viewProjection;
+        std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+        occluderTriangles = 0;
+    }
+
+    // draws one placed occluder into level 0
+    void rasterize(const OccluderMesh& mesh, const glm::mat4& world)
+    {
+        glm::mat4 mvp = viewProjection * world;
+        clip.resize(mesh.positions.size());
+        for (size_t v = 0; v < mesh.positions.size(); ++v)
+            clip[v] = mvp * glm::vec4(mesh.positions[v], 1.0f);
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            rasterizeTriangle(clip[mesh.indices[i]], clip[mesh.indices[i + 1]], clip[mesh.indices[i + 2]]);
+        occluderTriangles += mesh.triangles();
+    }
+
+    // builds levels 1.. from level 0; call after the last rasterize() of the view
+    void buildPyramid()
+    {
+        for (size_t l = 1; l < levels.size(); ++l)
+        {
+            const Level& below = levels[l - 1];
+            Level& level = levels[l];
+            for (int y = 0; y < level.height; ++y)
+                for (int x = 0; x < level.width; ++x)
+                {
+                    int x0 = x * 2, y0 = y * 2;
+                    int x1 = std::min(x0 + 1, below.width - 1), y1 = std::min(y0 + 1, below.height - 1);
+                    level.depth[(size_t)y * level.width + x] = std::max(std::max(below.at(x0, y0), below.at(x1, y0)),
+                                                                        std::max(below.at(x0, y1), below.at(x1, y1)));
+                }
+        }
+    }
+
+    // true when the world-space box is certainly hidden behind the rasterized occluders
+    bool occluded(const AABB& bounds) const
+    {
+        if (bounds.empty())
+            return false;
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1e30f;
+        for (int c = 0; c < 8; ++c)
+        {
+            glm::vec3 corner((c & 1) ? bounds.max.x : bounds.min.x, (c & 2) ? bounds.max.y : bounds.min.y, (c & 4) ? bounds.max.z : bounds.min.z);
+            glm::vec4 p = viewProjection * glm::vec4(corner, 1.0f);
+            if (p.w < NEAR_W)
+                return false;
+            float x = (p.x / p.w * 0.5f + 0.5f) * WIDTH, y = (p.y / p.w * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, p.z / p.w);
+        }
+        if (nearest < -1.0f)
+            return false;
+
+        // texel rectangle, one texel larger all round, clamped to the buffer
+        int x0 = std::max(0, (int)std::floor(minX) - 1), x1 = std::min(WIDTH - 1, (int)std::floor(maxX) + 1);
+        int y0 = std::max(0, (int)std::floor(minY) - 1), y1 = std::min(HEIGHT - 1, (int)std::floor(maxY) + 1);
+        if (x0 > x1 || y0 > y1)
+            return false; // off screen; the frustum test decides those
+        unsigned int l = 0;
+        while (l + 1 < levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+            ++l;
+        const Level& level = levels[l];
+        float farthest = -1.0f;
+        for (int y = y0 >> l; y <= (y1 >> l); ++y)
+            for (int x = x0 >> l; x <= (x1 >> l); ++x)
+                farthest = std::max(farthest, level.at(x, y));
+        return nearest > farthest + DEPTH_BIAS;
+    }
+
+private:
+    struct Level
+    {
+        int width, height;
+        std::vector<float> depth;
+
+        float at(int x, int y) const { return depth[(size_t)y * width + x]; }
+    };
+
+    std::vector<Level> levels;
+    glm::mat4 viewProjection;
+    std::vector<glm::vec4> clip;
+
+    // edge function; positive when c is to the left of a->b
+    static float edge(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+    {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+
+    // both windings, since occluders are closed and either side may face the camera;
+    // a triangle with any vertex in front of the near plane is skipped, since the
+    // GPU clips that part away and the buffer must not hide what is behind it
+    void rasterizeTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        if (a.z < -a.w || b.z < -b.w || c.z < -c.w)
+            return;
+        glm::vec2 p0((a.x / a.w * 0.5f + 0.5f) * WIDTH, (a.y / a.w * 0.5f + 0.5f) * HEIGHT);
+        glm::vec2 p1((b.x / b.w * 0.5f + 0.5f) * WIDTH, (b.y / b.w * 0.5f + 0.5f) * HEIGHT);
+        glm::vec2 p2((c.x / c.w * 0.5f + 0.5f) * WIDTH, (c.y / c.w * 0.5f + 0.5f) * HEIGHT);
+        float z0 = a.z / a.w, z1 = b.z / b.w, z2 = c.z / c.w;
+        if (std::min(z0, std::min(z1, z2)) > 1.0f)
+            return;
+        float area = edge(p0, p1, p2);
+        if (std::fabs(area) < 1e-8f)
+            return;
+        if (area < 0.0f)
+        {
+            std::swap(p1, p2);
+            std::swap(z1, z2);
+            area = -area;
+        }
+
+        // pixel centres inside the triangle's bounding box
+        int x0 = std::max(0, (int)std::ceil(std::min(p0.x, std::min(p1.x, p2.x)) - 0.5f));
+        int x1 = std::min(WIDTH - 1, (int)std::floor(std::max(p0.x, std::max(p1.x, p2.x)) - 0.5f));
+        int y0 = std::max(0, (int)std::ceil(std::min(p0.y, std::min(p1.y, p2.y)) - 0.5f));
+        int y1 = std::min(HEIGHT - 1, (int)std::floor(std::max(p0.y, std::max(p1.y, p2.y)) - 0.5f));
+        std::vector<float>& depth = levels[0].depth;
+        for (int y = y0; y <= y1; ++y)
+            for (int x = x0; x <= x1; ++x)
+            {
+                glm::vec2 p(x + 0.5f, y + 0.5f);
+                float w0 = edge(p1, p2, p), w1 = edge(p2, p0, p), w2 = edge(p0, p1, p);
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+                // NDC depth is affine in screen space, so plain barycentrics interpolate it
+                float z = (w0 * z0 + w1 * z1 + w2 * z2) / area;
+                float& stored = depth[(size_t)y * WIDTH + x];
+                stored = std::min(stored, z);
+            }
+    }
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Per-frame, per-pass timings for the benchmark mode.
+// Every pass gets a CPU scope (submission cost) and a GL_TIME_ELAPSED query
+// (GPU cost). Queries live in a small ring so the result read back for a slot
+// is always a few frames old and never stalls the pipeline.
+class FrameProfiler
+{
+public:
+    static const int QUERY_RING = 4;
+
+    bool enabled;
+
+    // no GL calls here, so a profiler can be a global created before the context;
+    // query objects are generated on a pass's first use
+    FrameProfiler(const std::vector<std::string>& passNames, int warmupFrames = 0, bool enabled = false)
+        : enabled(enabled), names(passNames), warmup(warmupFrames), frame(-1)
+    {
+        passes.resize(names.size());
+        for (Pass& pass : passes)
+        {
+            pass.queries[0] = 0;
+            for (int i = 0; i < QUERY_RING; ++i)
+                pass.queryFrame[i] = -1;
+        }
+    }
+
+    void configure(int warmupFrames, bool enable)
+    {
+        warmup = warmupFrames;
+        enabled = enable;
+    }
+
+    // sizes the per-frame sample lists for a run of this many recorded frames,
+    // so recording them never reallocates mid-run
+    void reserveFrames(int frames)
+    {
+        frameMs.reserve(frames);
+        for (Pass& pass : passes)
+        {
+            pass.cpuMs.reserve(frames);
+            pass.gpuMs.reserve(frames);
+        }
+    }
+
+    void beginFrame()
+    {
+        if (!enabled)
+            return;
+        ++frame;
+        frameStart = Clock::now();
+    }
+
+    void endFrame()
+    {
+        if (!enabled)
+            return;
+        if (recording(frame))
+            frameMs.push_back(elapsedMs(frameStart));
+    }
+
+    void beginPass(int index)
+    {
+        if (!enabled)
+            return;
+        Pass& pass = passes[index];
+        if (pass.queries[0] == 0)
+            glGenQueries(QUERY_RING, pass.queries);
+        int slot = frame % QUERY_RING;
+        // the slot still holds the query from QUERY_RING frames ago; collect it first
+        collect(pass, slot);
+        glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+        pass.queryFrame[slot] = frame;
+        pass.cpuStart = Clock::now();
+    }
+
+    void endPass(int index)
+    {
+        if (!enabled)
+            return;
+        Pass& pass = passes[index];
+        if (recording(frame))
+            pass.cpuMs.push_back(elapsedMs(pass.cpuStart));
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    // read back every query still in flight, call once after the last frame
+    void finish()
+    {
+        if (!enabled)
+            return;
+        for (Pass& pass : passes)
+            for (int slot = 0; slot < QUERY_RING; ++slot)
+                collect(pass, slot);
+        for (auto& counter : samples)
+            for (int slot = 0; slot < QUERY_RING; ++slot)
+                collectSamples(counter.second, slot);
+    }
+
+    // counts the samples that pass the depth test between beginSamples() and
+    // endSamples() into the named counter, through a query ring like the timers.
+    // name must outlive the profiler (a string literal), like FrameTracer's names
+    void beginSamples(const char* name)
+    {
+        if (!enabled)
+            return;
+        std::unordered_map<const char*, SampleQueries*>::iterator it = samplesByName.find(name);
+        if (it == samplesByName.end())
+        {
+            SampleQueries& added = samples[name];
+            added.counter = &counters[name];
+            it = samplesByName.insert(std::make_pair(name, &added)).first;
+        }
+        SampleQueries& queries = *it->second;
+        if (queries.queries[0] == 0)
+            glGenQueries(QUERY_RING, queries.queries);
+        int slot = frame % QUERY_RING;
+        collectSamples(queries, slot);
+        glBeginQuery(GL_SAMPLES_PASSED, queries.queries[slot]);
+        queries.queryFrame[slot] = frame;
+    }
+
+    void endSamples()
+    {
+        if (!enabled)
+            return;
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
+
+    // Accumulates a named per-frame counter (draw calls, cache hits, ...). Counters
+    // are found by the address of their name, so a counter only builds its string
+    // key the first time it is seen, warm-up frames included; name must outlive
+    // the profiler (a string literal).
+    void count(const char* name, double value)
+    {
+        if (!enabled)
+            return;
+        std::unordered_map<const char*, double*>::iterator it = countersByName.find(name);
+        if (it == countersByName.end())
+            it = countersByName.insert(std::make_pair(name, &counters[name])).first;
+        if (recording(frame))
+            *it->second += value;
+    }
+
+    int recordedFrames() const { return (int)frameMs.size(); }
+
+    void report(std::ostream& out) const
+    {
+        out << std::fixed << std::setprecision(3);
+        out << "frame times (ms) over " << frameMs.size() << " frames, " << warmup << " warm-up frames skipped" << std::endl;
+        out << std::left << std::setw(16) << "scope" << std::right
+            << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p95"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+        printRow(out, "frame", frameMs);
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            if (passes[i].cpuMs.empty())
+                continue; // pass never ran, e.g. a mode that was switched off
+            printRow(out, names[i] + " cpu", passes[i].cpuMs);
+            printRow(out, names[i] + " gpu", passes[i].gpuMs);
+        }
+        if (counters.empty())
+            return;
+        out << "counters (total, per frame)" << std::endl;
+        for (const auto& counter : counters)
+            out << std::left << std::setw(28) << counter.first << std::right << std::setw(14) << counter.second
+                << std::setw(14) << counter.second / std::max(1, recordedFrames()) << std::endl;
+    }
+
+    static double percentile(std::vector<double> samples, double p)
+    {
+        if (samples.empty())
+            return 0.0;
+        size_t rank = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+        std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank];
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pass
+    {
+        unsigned int queries[QUERY_RING];
+        int queryFrame[QUERY_RING];
+        Clock::time_point cpuStart;
+        std::vector<double> cpuMs;
+        std::vector<double> gpuMs;
+    };
+
+    struct SampleQueries
+    {
+        unsigned int queries[QUERY_RING];
+        int queryFrame[QUERY_RING];
+        double* counter; // where the passed samples are added
+
+        SampleQueries() : counter(nullptr)
+        {
+            queries[0] = 0;
+            for (int i = 0; i < QUERY_RING; ++i)
+                queryFrame[i] = -1;
+        }
+    };
+
+    std::vector<std::string> names;
+    std::vector<Pass> passes;
+    std::map<std::string, SampleQueries> samples;
+    std::vector<double> frameMs;
+    std::map<std::string, double> counters; // map nodes never move, so the pointers below stay valid
+    std::unordered_map<const char*, double*> countersByName;
+    std::unordered_map<const char*, SampleQueries*> samplesByName;
+    int warmup;
+    int frame;
+    Clock::time_point frameStart;
+
+    bool recording(int f) const { return f >= warmup; }
+
+    static double elapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    void collect(Pass& pass, int slot)
+    {
+        if (pass.queryFrame[slot] < 0)
+            return;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &ns);
+        if (recording(pass.queryFrame[slot]))
+            pass.gpuMs.push_back(ns / 1.0e6);
+        pass.queryFrame[slot] = -1;
+    }
+
+    void collectSamples(SampleQueries& queries, int slot)
+    {
+        if (queries.queryFrame[slot] < 0)
+            return;
+        GLuint64 passed = 0;
+        glGetQueryObjectui64v(queries.queries[slot], GL_QUERY_RESULT, &passed);
+        if (recording(queries.queryFrame[slot]))
+            *queries.counter += (double)passed;
+        queries.queryFrame[slot] = -1;
+    }
+
+    static void printRow(std::ostream& out, const std::string& label, const std::vector<double>& samples)
+    {
+        double mean = 0.0, worst = 0.0;
+        for (double s : samples)
+        {
+            mean += s;
+            worst = std::max(worst, s);
+        }
+        if (!samples.empty())
+            mean /= samples.size();
+        out << std::left << std::setw(16) << label << std::right
+            << std::setw(10) << mean
+            << std::setw(10) << percentile(samples, 50.0)
+            << std::setw(10) << percentile(samples, 95.0)
+            << std::setw(10) << percentile(samples, 99.0)
+            << std::setw(10) << worst << std::endl;
+    }
+};
+
+#endif
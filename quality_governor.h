@@ -0,0 +1,251 @@
+#ifndef QUALITY_GOVERNOR_H
+#define QUALITY_GOVERNOR_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+
+// One rung of the quality ladder. The cheapest change comes first: PCF taps,
+// then internal resolution, then the shadow cubemap size.
+struct QualityLevel
+{
+    float renderScale;       // internal resolution per axis, blitted up to the output
+    unsigned int shadowSize; // shadow cubemap face size
+    int shadowSamples;       // PCF taps, a prefix of the shader's 20-tap disk
+};
+
+const QualityLevel QUALITY_LEVELS[] = {
+    { 1.0f, 1024, 20 },
+    { 1.0f, 1024, 12 },
+    { 0.85f, 1024, 12 },
+    { 0.85f, 512, 8 },
+    { 0.7f, 512, 8 },
+    { 0.7f, 512, 4 },
+    { 0.5f, 256, 4 },
+};
+const int QUALITY_LEVEL_COUNT = sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]);
+
+// Holds the frame time under a budget by walking the quality ladder.
+// A frame costs the larger of its CPU time (frame start to just before the swap,
+// so vsync waits do not count) and its GPU time (a GL_TIMESTAMP pair read back
+// QUERY_RING frames later). The cost is smoothed, and the level only moves after
+// it has stayed past a threshold for a run of frames: down after DOWNGRADE_FRAMES
+// above the budget, up after a much longer run below UPGRADE_HEADROOM of it.
+// Every change is followed by a cooldown, so the new level's timings settle
+// before the next decision. An upgrade that is undone soon after doubles the run
+// the next upgrade needs, so a level that does not fit is not retried every few seconds.
+// Rungs that only change the PCF taps are stepped over while the shadows are
+// filtered some other way, since VSM and ESM never read the tap count.
+class QualityGovernor
+{
+public:
+    static const int QUERY_RING = 4;
+    static const unsigned int DOWNGRADE_FRAMES = 10;
+    static const unsigned int UPGRADE_FRAMES = 120;
+    static const unsigned int MAX_UPGRADE_FRAMES = 1920;
+    static const unsigned int COOLDOWN_FRAMES = QUERY_RING + 16;
+    static constexpr float DOWNGRADE_RATIO = 1.05f;
+    static constexpr float UPGRADE_HEADROOM = 0.75f;
+    static constexpr float SMOOTHING = 0.1f; // weight of the newest frame in the moving average
+
+    bool enabled;
+    bool pcfShadows; // the shadow filter in use reads shadowSamples; set by the caller every frame
+    float budgetMs;
+    unsigned int downgrades, upgrades;
+
+    QualityGovernor()
+        : enabled(false), pcfShadows(true), budgetMs(0.0f), downgrades(0), upgrades(0), current(0), smoothed(0.0), frame(-1),
+          overFrames(0), underFrames(0), cooldown(0), upgradeFrames(UPGRADE_FRAMES), sinceUpgrade(~0u)
+    {
+        queries[0][0] = 0;
+        for (int i = 0; i < QUERY_RING; ++i)
+        {
+            queryFrame[i] = -1;
+            gpuMs[i] = 0.0;
+        }
+    }
+
+    // starts governing towards budget milliseconds per frame; no GL calls, so it can run before the context exists
+    void start(float budget)
+    {
+        budgetMs = budget;
+        enabled = budget > 0.0f;
+    }
+
+    int level() const { return current; }
+    const QualityLevel& settings() const { return QUALITY_LEVELS[enabled ? current : 0]; }
+    double smoothedMs() const { return smoothed; }
+
+    void beginFrame()
+    {
+        if (!enabled)
+            return;
+        if (queries[0][0] == 0)
+            glGenQueries(2 * QUERY_RING, queries[0]);
+        ++frame;
+        int slot = frame % QUERY_RING;
+        // the slot's timestamps were issued QUERY_RING frames ago
+        if (queryFrame[slot] >= 0)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+            gpuMs[slot] = (end - begin) / 1.0e6;
+        }
+        glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+        queryFrame[slot] = frame;
+        cpuStart = Clock::now();
+    }
+
+    // call before the swap; true when the level changed, to take effect from the next frame
+    bool endFrame()
+    {
+        if (!enabled)
+            return false;
+        int slot = frame % QUERY_RING;
+        glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+        double cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - cpuStart).count();
+        // the GPU time of this slot is from QUERY_RING frames ago, the latest one known
+        double cost = frame >= QUERY_RING ? std::max(cpuMs, gpuMs[slot]) : cpuMs;
+        return observe(cost);
+    }
+
+    // feeds one frame's cost in milliseconds through the smoothing and the hysteresis
+    bool observe(double frameMs)
+    {
+        smoothed = smoothed == 0.0 ? frameMs : smoothed + (frameMs - smoothed) * SMOOTHING;
+        if (sinceUpgrade != ~0u)
+            ++sinceUpgrade;
+        if (cooldown > 0)
+        {
+            --cooldown;
+            return false;
+        }
+
+        if (smoothed > budgetMs * DOWNGRADE_RATIO)
+        {
+            ++overFrames;
+            underFrames = 0;
+        }
+        else if (smoothed < budgetMs * UPGRADE_HEADROOM)
+        {
+            ++underFrames;
+            overFrames = 0;
+        }
+        else
+            overFrames = underFrames = 0;
+
+        int lower = step(current, 1), higher = step(current, -1);
+        if (overFrames >= DOWNGRADE_FRAMES && lower != current)
+        {
+            if (sinceUpgrade < 2 * upgradeFrames)
+                upgradeFrames = upgradeFrames * 2 < MAX_UPGRADE_FRAMES ? upgradeFrames * 2 : MAX_UPGRADE_FRAMES;
+            sinceUpgrade = ~0u;
+            current = lower;
+            ++downgrades;
+            return changed();
+        }
+        if (underFrames >= upgradeFrames && higher != current)
+        {
+            sinceUpgrade = 0;
+            current = higher;
+            ++upgrades;
+            return changed();
+        }
+        return false;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    int current;
+    double smoothed;
+    int frame;
+    unsigned int queries[QUERY_RING][2]; // begin/end GL_TIMESTAMP per ring slot
+    int queryFrame[QUERY_RING];
+    double gpuMs[QUERY_RING];
+    Clock::time_point cpuStart;
+    unsigned int overFrames, underFrames;
+    unsigned int cooldown;
+    unsigned int upgradeFrames; // run below the headroom an upgrade needs, doubled on each reverted upgrade
+    unsigned int sinceUpgrade; // frames since the last upgrade, ~0u when there is none to revert
+
+    // The next rung from `from` in direction (+1 down, -1 up), or `from` at the end
+    // of the ladder. Without PCF, rungs that differ only in taps look the same, so
+    // the step goes to the first rung that differs and lands on the best of the run
+    // of equal-looking rungs there.
+    int step(int from, int direction) const
+    {
+        int to = from + direction;
+        if (!pcfShadows)
+            while (to >= 0 && to < QUALITY_LEVEL_COUNT && sameWithoutTaps(to, from))
+                to += direction;
+        if (to < 0 || to >= QUALITY_LEVEL_COUNT)
+            return from;
+        if (!pcfShadows)
+            while (to > 0 && sameWithoutTaps(to - 1, to))
+                --to;
+        return to;
+    }
+
+    static bool sameWithoutTaps(int a, int b)
+    {
+        return QUALITY_LEVELS[a].renderScale == QUALITY_LEVELS[b].renderScale && QUALITY_LEVELS[a].shadowSize == QUALITY_LEVELS[b].shadowSize;
+    }
+
+    bool changed()
+    {
+        overFrames = underFrames = 0;
+        cooldown = COOLDOWN_FRAMES;
+        return true;
+    }
+};
+
+// Colour and depth/stencil renderbuffers the scene is drawn into below the
+// output resolution, then stretched onto the output with a linear blit.
+// Storage is (re)allocated on the first resize() to a new size.
+class ScaledTarget
+{
+public:
+    unsigned int fbo;
+    unsigned int width, height;
+
+    ScaledTarget() : fbo(0), width(0), height(0), color(0), depth(0) {}
+
+    void resize(unsigned int w, unsigned int h)
+    {
+        if (fbo != 0 && w == width && h == height)
+            return;
+        if (fbo == 0)
+        {
+            glGenFramebuffers(1, &fbo);
+            glGenRenderbuffers(1, &color);
+            glGenRenderbuffers(1, &depth);
+        }
+        width = w;
+        height = h;
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // upscales the colour onto target (0 = default framebuffer) and leaves target bound
+    void blitTo(unsigned int target, unsigned int targetWidth, unsigned int targetHeight) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, targetWidth, targetHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+private:
+    unsigned int color, depth;
+};
+
+#endif
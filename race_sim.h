@@ -0,0 +1,368 @@
+#ifndef RACE_SIM_H
+#define RACE_SIM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define RACE_SIMD 1
+#endif
+
+const float RACE_TRACK_END = 34.5f; // cars stop at the end of the straight
+
+// Every car on the grid as one array per field. Launch profiles (reaction,
+// acceleration, top speed) are drawn once per race; z and speed are the state.
+// Speeds and accelerations are per tick, reaction is in ticks after the launch.
+struct RaceField
+{
+    std::vector<float> x; // lane, fixed for the race
+    std::vector<float> z;
+    std::vector<float> speed;
+    std::vector<float> topSpeed;
+    std::vector<float> accel;
+    std::vector<float> reaction;
+
+    unsigned int size() const { return (unsigned int)z.size(); }
+
+    void resize(unsigned int cars)
+    {
+        for (std::vector<float>* column : { &x, &z, &speed, &topSpeed, &accel, &reaction })
+            column->assign(cars, 0.0f);
+    }
+};
+
+// One tick for cars [first, last): once a car's reaction time has passed since the
+// launch it accelerates up to its top speed, and no car passes the track end.
+inline void stepCarsScalar(RaceField& field, unsigned int first, unsigned int last, float launched)
+{
+    for (unsigned int i = first; i < last; ++i)
+    {
+        if (launched >= field.reaction[i])
+            field.speed[i] = std::min(field.speed[i] + field.accel[i], field.topSpeed[i]);
+        field.z[i] = std::min(field.z[i] + field.speed[i], RACE_TRACK_END);
+    }
+}
+
+// same kernel, four cars per SSE lane with a scalar tail
+inline void stepCars(RaceField& field, unsigned int first, unsigned int last, float launched)
+{
+    unsigned int i = first;
+#ifdef RACE_SIMD
+    const __m128 now = _mm_set1_ps(launched);
+    const __m128 end = _mm_set1_ps(RACE_TRACK_END);
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 started = _mm_cmpge_ps(now, _mm_loadu_ps(&field.reaction[i]));
+        __m128 speed = _mm_loadu_ps(&field.speed[i]);
+        __m128 accel = _mm_and_ps(started, _mm_loadu_ps(&field.accel[i]));
+        speed = _mm_min_ps(_mm_add_ps(speed, accel), _mm_loadu_ps(&field.topSpeed[i]));
+        _mm_storeu_ps(&field.speed[i], speed);
+        _mm_storeu_ps(&field.z[i], _mm_min_ps(_mm_add_ps(_mm_loadu_ps(&field.z[i]), speed), end));
+    }
+#endif
+    stepCarsScalar(field, i, last, launched);
+}
+
+// The race start as a fixed-timestep simulation of any number of cars. Ticks
+// advance by STEP seconds of simulation time no matter how often they are run,
+// inputs are latched at the start of a tick, and launch profiles come from a
+// private seeded generator, so the same seed and per-tick inputs always produce
+// the same states.
+//
+// advanceTo() is called by exactly one thread: the simulation thread started by
+// start(), or the render thread itself when running inline. Each batch of ticks
+// is published as the car positions before and after its last tick into a
+// two-slot buffer guarded by per-slot sequence numbers; sample() copies the
+// newest pair without locking and retries in the rare case the writer lapped it.
+class RaceSimulation
+{
+public:
+    static constexpr double STEP = 1.0 / 60.0; // the old per-frame step, at 60 Hz
+
+    explicit RaceSimulation(uint32_t seed = 1, unsigned int cars = 3)
+        : accelerating(false), resetRequested(false), stopping(false), latestSlot(0)
+    {
+        reseed(seed, cars);
+    }
+
+    ~RaceSimulation() { stop(); }
+
+    RaceSimulation(const RaceSimulation&) = delete;
+    RaceSimulation& operator=(const RaceSimulation&) = delete;
+
+    // restarts from tick 0 with a new seed and grid size; only while no simulation thread runs
+    void reseed(uint32_t seed, unsigned int cars)
+    {
+        rng = seed ? seed : 1;
+        tick = 0;
+        field.resize(cars);
+        previousZ.assign(cars, 0.0f);
+        for (Slot& slot : slots)
+        {
+            slot.sequence = 0;
+            slot.previous.assign(cars, 0.0f);
+            slot.current.assign(cars, 0.0f);
+        }
+        resetGrid();
+        publish();
+    }
+
+    void reseed(uint32_t seed) { reseed(seed, cars()); }
+
+    unsigned int cars() const { return field.size(); }
+
+    // grid lane of a car; constant between reseeds, so safe to read from any thread
+    float laneX(unsigned int car) const { return field.x[car]; }
+
+    // inputs, from any thread; applied at the next tick
+    void setAccelerating(bool on) { accelerating = on; }
+    void requestReset() { resetRequested = true; }
+
+    // seconds on the simulation clock, starting at zero when the object was created
+    double clock() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    // runs every whole tick up to time (seconds) and publishes the last two
+    void advanceTo(double time)
+    {
+        uint64_t target = (uint64_t)(time / STEP);
+        if (tick >= target)
+            return;
+        while (tick < target)
+        {
+            previousZ = field.z;
+            step();
+        }
+        publish();
+    }
+
+    // car positions at time, interpolated between the two newest ticks; times outside
+    // that range clamp to it. Renderers ask for clock() - STEP so there is always a pair.
+    // Returns the newest tick.
+    uint64_t sample(double time, std::vector<float>& z) const
+    {
+        uint64_t current = read(z, scratch);
+        float alpha = (float)((time - (current - 1) * STEP) / STEP);
+        alpha = alpha < 0.0f ? 0.0f : alpha > 1.0f ? 1.0f : alpha;
+        for (unsigned int c = 0; c < z.size(); ++c)
+            z[c] = scratch[c] + (z[c] - scratch[c]) * alpha;
+        return current;
+    }
+
+    // positions after the newest published tick, not interpolated
+    uint64_t latest(std::vector<float>& z) const
+    {
+        return read(z, scratch);
+    }
+
+    // FNV-1a over the tick and every car's state, equal on every run that saw the same
+    // seed and inputs; call from the stepping thread or after stop()
+    uint64_t hash() const
+    {
+        uint64_t h = 14695981039346656037ull;
+        hashBytes(h, &tick, sizeof(tick));
+        hashBytes(h, field.z.data(), field.z.size() * sizeof(float));
+        hashBytes(h, field.speed.data(), field.speed.size() * sizeof(float));
+        return h;
+    }
+
+    uint64_t ticks() const { return tick; }
+
+    // steps in real time on a thread of its own until stop()
+    void start()
+    {
+        if (worker.joinable())
+            return;
+        stopping = false;
+        worker = std::thread([this]
+        {
+            while (!stopping)
+            {
+                advanceTo(clock());
+                std::this_thread::sleep_for(std::chrono::duration<double>(STEP * 0.5));
+            }
+        });
+    }
+
+    void stop()
+    {
+        stopping = true;
+        if (worker.joinable())
+            worker.join();
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence; // odd while being written
+        uint64_t tick;
+        std::vector<float> previous;
+        std::vector<float> current;
+    };
+
+    // owned by the stepping thread
+    RaceField field;
+    std::vector<float> previousZ;
+    uint64_t tick;
+    float launched; // ticks since the cars were released
+    uint32_t rng;
+
+    std::atomic<bool> accelerating;
+    std::atomic<bool> resetRequested;
+    std::atomic<bool> stopping;
+    std::thread worker;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    Slot slots[2];
+    std::atomic<unsigned int> latestSlot;
+    mutable std::vector<float> scratch; // reader side, render thread only
+
+    static void hashBytes(uint64_t& h, const void* data, size_t size)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i)
+            h = (h ^ bytes[i]) * 1099511628211ull;
+    }
+
+    // xorshift32, so the grid does not depend on the C library's rand()
+    uint32_t random()
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng;
+    }
+
+    // The first three cars keep the original grid slots; the rest line up behind
+    // them eight abreast. Top speeds are the old 0.03 - 0.1 per tick.
+    void resetGrid()
+    {
+        const float gridX[3] = { -1.3f, 1.4f, -1.4f };
+        const float gridZ[3] = { 0.0f, -5.0f, -10.2f };
+        for (unsigned int c = 0; c < cars(); ++c)
+        {
+            if (c < 3)
+            {
+                field.x[c] = gridX[c];
+                field.z[c] = gridZ[c];
+            }
+            else
+            {
+                field.x[c] = -9.8f + 2.8f * ((c - 3) % 8);
+                field.z[c] = -15.4f - 5.2f * ((c - 3) / 8);
+            }
+            field.speed[c] = 0.0f;
+            field.topSpeed[c] = (random() % 70 + 30) / 1000.0f;
+            field.accel[c] = field.topSpeed[c] / (10 + random() % 50);
+            field.reaction[c] = (float)(random() % 20);
+        }
+        launched = 0.0f;
+        previousZ = field.z; // no interpolation across the jump back to the grid
+    }
+
+    void step()
+    {
+        if (resetRequested.exchange(false))
+            resetGrid();
+        if (accelerating)
+        {
+            stepCars(field, 0, cars(), launched);
+            launched += 1.0f;
+        }
+        ++tick;
+    }
+
+    void publish()
+    {
+        unsigned int index = (latestSlot.load(std::memory_order_relaxed) + 1) & 1u;
+        Slot& slot = slots[index];
+        slot.sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.tick = tick;
+        std::memcpy(slot.previous.data(), previousZ.data(), previousZ.size() * sizeof(float));
+        std::memcpy(slot.current.data(), field.z.data(), field.z.size() * sizeof(float));
+        slot.sequence.fetch_add(1, std::memory_order_release);
+        latestSlot.store(index, std::memory_order_release);
+    }
+
+    uint64_t read(std::vector<float>& current, std::vector<float>& previous) const
+    {
+        current.resize(field.size());
+        previous.resize(field.size());
+        for (;;)
+        {
+            const Slot& slot = slots[latestSlot.load(std::memory_order_acquire)];
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before & 1u)
+                continue;
+            uint64_t slotTick = slot.tick;
+            std::memcpy(current.data(), slot.current.data(), current.size() * sizeof(float));
+            std::memcpy(previous.data(), slot.previous.data(), previous.size() * sizeof(float));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before)
+                return slotTick;
+        }
+    }
+};
+
+// Headless throughput of the step kernel: a field of `cars` stepped for `ticks`
+// ticks, split into contiguous slices over 1, 2, 4, ... threads up to maxThreads.
+// Cars never interact, so each thread runs all ticks over its slice unsynchronised.
+inline void benchmarkRace(std::ostream& out, unsigned int cars, unsigned int ticks, unsigned int maxThreads)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // a fresh field per run, timed over the whole field
+    auto run = [&](unsigned int threads, bool simd)
+    {
+        RaceField field;
+        field.resize(cars);
+        for (unsigned int c = 0; c < cars; ++c)
+        {
+            field.z[c] = -5.2f * (c / 8);
+            field.topSpeed[c] = (30 + c % 70) / 1000.0f;
+            field.accel[c] = field.topSpeed[c] / (10 + c % 50);
+            field.reaction[c] = (float)(c % 20);
+        }
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> workers;
+        unsigned int slice = ((cars + threads - 1) / threads + 3) & ~3u; // SSE-aligned slices
+        for (unsigned int t = 0; t < threads; ++t)
+        {
+            unsigned int first = std::min(cars, t * slice), last = std::min(cars, first + slice);
+            workers.push_back(std::thread([&field, first, last, ticks, simd]
+            {
+                for (unsigned int k = 0; k < ticks; ++k)
+                {
+                    if (simd)
+                        stepCars(field, first, last, (float)k);
+                    else
+                        stepCarsScalar(field, first, last, (float)k);
+                }
+            }));
+        }
+        for (std::thread& worker : workers)
+            worker.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return (double)cars * ticks / seconds;
+    };
+
+    out << "race simulation: " << cars << " cars x " << ticks << " ticks" << std::endl;
+    out << std::fixed << std::setprecision(1);
+    out << "  scalar   1 thread   " << std::setw(10) << run(1, false) / 1e6 << " M car-steps/s" << std::endl;
+    for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+        out << "  simd   " << std::setw(3) << threads << (threads == 1 ? " thread   " : " threads  ")
+            << std::setw(10) << run(threads, true) / 1e6 << " M car-steps/s" << std::endl;
+}
+
+#endif
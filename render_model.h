@@ -0,0 +1,397 @@
+#ifndef RENDER_MODEL_H
+#define RENDER_MODEL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+
+#include "culling.h"
+#include "mesh_cache.h"
+#include "scene.h"
+#include "shader_program.h"
+#include "texture_cache.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// per-instance vertex data, read by the *Instanced.vert shaders
+struct InstanceData
+{
+    glm::mat4 world;
+    glm::mat3 normal;
+};
+
+// first attribute location used for instance data; 0-2 hold the PackedVertex layout
+// and 3-6 stay free for the attributes the learnopengl Mesh layout adds
+const unsigned int INSTANCE_ATTRIB = 7;
+
+// which instances of a model to draw: static ones are stored first in the buffer
+enum InstanceSet { INSTANCES_ALL, INSTANCES_STATIC, INSTANCES_DYNAMIC };
+
+// GPU copy of one mesh: PackedVertex or QuantizedVertex VBO, index buffer with every LOD, and its textures
+struct RenderMesh
+{
+    unsigned int VAO, VBO, EBO;
+    bool quantized;
+    glm::vec3 positionOffset, positionScale; // decode of quantized positions, set as uniforms of the same name
+    unsigned int lodCount;
+    unsigned int lodFirst[MESH_MAX_LODS]; // first index of each LOD in the EBO
+    unsigned int lodIndexCount[MESH_MAX_LODS];
+    std::vector<unsigned int> textures; // bound to units 0..n
+    unsigned int textureSet; // same id for every mesh with the same texture list
+};
+
+// small dense id per distinct texture list, so draws can be sorted and compared by it
+inline unsigned int textureSetId(const std::vector<unsigned int>& textures)
+{
+    static std::map<std::vector<unsigned int>, unsigned int> ids;
+    std::map<std::vector<unsigned int>, unsigned int>::iterator it = ids.find(textures);
+    if (it == ids.end())
+        it = ids.insert(std::make_pair(textures, (unsigned int)ids.size())).first;
+    return it->second;
+}
+
+// The meshes of one model plus a per-instance matrix buffer attached to every
+// mesh VAO, so all placements of the model go out in one instanced draw per mesh.
+// A second, streamed buffer holds the instances that survived culling for up
+// to MAX_VIEWS views (e.g. the six shadow cubemap faces), one range per view
+// and LOD, so each view costs one instanced draw per mesh and LOD in use.
+class RenderModel
+{
+public:
+    static const unsigned int MAX_VIEWS = 6;
+
+    std::vector<RenderMesh> meshes;
+    AABB bounds; // model space, over all meshes
+    std::vector<AABB> meshBounds; // model space, one per mesh
+    unsigned int triangles; // per instance, over all meshes
+    unsigned int lodCount; // most LODs of any mesh; meshes with fewer reuse their last
+    float lodError[MESH_MAX_LODS]; // model space, worst mesh at each level
+    unsigned int lodTriangles[MESH_MAX_LODS]; // per instance at each level
+    unsigned int instanceVBO;
+    unsigned int instanceCount;
+    unsigned int staticCount; // instances [0, staticCount) are static, the rest dynamic
+    float sourceAcmr, acmr; // LOD 0 post-transform cache misses per triangle, as imported and as uploaded
+    unsigned int vertexSize; // bytes per vertex in the VBOs
+
+    // culled instances, filled through addVisible()/endView() then uploaded with uploadVisible()
+    std::vector<InstanceData> visible;
+    unsigned int viewFirst[MAX_VIEWS][MESH_MAX_LODS];
+    unsigned int viewCount[MAX_VIEWS][MESH_MAX_LODS];
+
+    // Uploads the vertex/index arrays straight from the data, which may point into a
+    // mapped cache file. Texture paths are looked up in the given GL textures first
+    // and anything missing is loaded synchronously through the texture cache. quantize converts the vertices
+    // to QuantizedVertex on the way, for the QUANTIZED_VERTICES shader variants.
+    RenderModel(const ModelData& data, const std::map<std::string, unsigned int>& textures = std::map<std::string, unsigned int>(), bool quantize = false)
+        : triangles(0), lodCount(1), instanceVBO(0), instanceCount(0), staticCount(0), sourceAcmr(0.0f), acmr(0.0f),
+          vertexSize(quantize ? sizeof(QuantizedVertex) : sizeof(PackedVertex)), visibleVBO(0), boundBuffer(0), boundFirst(0)
+    {
+        clearVisible();
+        for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+        {
+            lodError[l] = 0.0f;
+            lodTriangles[l] = 0;
+        }
+
+        glGenBuffers(1, &instanceVBO);
+        glGenBuffers(1, &visibleVBO);
+        std::map<std::string, unsigned int> loadedTextures(textures);
+        std::vector<QuantizedVertex> quantized;
+        for (const MeshData& source : data.meshes)
+        {
+            RenderMesh mesh;
+            mesh.quantized = quantize;
+            mesh.positionOffset = source.bounds.empty() ? glm::vec3(0.0f) : source.bounds.center();
+            mesh.positionScale = source.bounds.empty() ? glm::vec3(1.0f) : glm::max(source.bounds.extent(), glm::vec3(1e-6f));
+            mesh.lodCount = source.lodCount;
+            for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+            {
+                unsigned int level = std::min(l, source.lodCount - 1);
+                mesh.lodFirst[l] = source.lodFirst[level];
+                mesh.lodIndexCount[l] = source.lodIndexCount[level];
+                lodError[l] = std::max(lodError[l], source.lodError[level]);
+                lodTriangles[l] += source.lodIndexCount[level] / 3;
+            }
+            lodCount = std::max(lodCount, source.lodCount);
+            for (const std::string& path : source.textures)
+            {
+                std::map<std::string, unsigned int>::iterator it = loadedTextures.find(path);
+                if (it == loadedTextures.end())
+                    it = loadedTextures.insert(std::make_pair(path, textureCache().load(data.directory + '/' + path))).first;
+                mesh.textures.push_back(it->second);
+            }
+            mesh.textureSet = textureSetId(mesh.textures);
+
+            glGenVertexArrays(1, &mesh.VAO);
+            glGenBuffers(1, &mesh.VBO);
+            glGenBuffers(1, &mesh.EBO);
+            glBindVertexArray(mesh.VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+            if (quantize)
+            {
+                const PackedVertex* vertices = source.vertices();
+                quantized.resize(source.vertexCount);
+                for (unsigned int v = 0; v < source.vertexCount; ++v)
+                    quantized[v] = quantizeVertex(vertices[v].position, vertices[v].normal, vertices[v].texCoords, mesh.positionOffset, mesh.positionScale);
+                glBufferData(GL_ARRAY_BUFFER, source.vertexCount * sizeof(QuantizedVertex), quantized.data(), GL_STATIC_DRAW);
+            }
+            else
+                glBufferData(GL_ARRAY_BUFFER, source.vertexCount * sizeof(PackedVertex), source.vertices(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, source.indexCount * sizeof(unsigned int), source.indices(), GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+            if (quantize)
+            {
+                glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, position));
+                glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, normal));
+                glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, texCoords));
+            }
+            else
+            {
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoords));
+            }
+
+            setInstancePointers(instanceVBO, 0);
+            for (unsigned int c = 0; c < 7; ++c)
+            {
+                glEnableVertexAttribArray(INSTANCE_ATTRIB + c);
+                glVertexAttribDivisor(INSTANCE_ATTRIB + c, 1);
+            }
+
+            meshes.push_back(mesh);
+            meshBounds.push_back(source.bounds);
+            bounds.expand(source.bounds);
+            triangles += source.lodIndexCount[0] / 3;
+            sourceAcmr += source.sourceAcmr * (source.lodIndexCount[0] / 3);
+            acmr += analyzeVertexCache(source.indices(), source.lodIndexCount[0], source.vertexCount) * (source.lodIndexCount[0] / 3);
+        }
+        if (triangles > 0)
+        {
+            sourceAcmr /= triangles;
+            acmr /= triangles;
+        }
+        boundBuffer = instanceVBO;
+        glBindVertexArray(0);
+    }
+
+    // frees the buffers and VAOs; textures may be shared and are left alone
+    void release()
+    {
+        for (const RenderMesh& mesh : meshes)
+        {
+            glDeleteVertexArrays(1, &mesh.VAO);
+            glDeleteBuffers(1, &mesh.VBO);
+            glDeleteBuffers(1, &mesh.EBO);
+        }
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteBuffers(1, &visibleVBO);
+        meshes.clear();
+        meshBounds.clear();
+        instanceVBO = visibleVBO = 0;
+    }
+
+    void uploadInstances(const std::vector<InstanceData>& instances, unsigned int staticInstances)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        instanceCount = (unsigned int)instances.size();
+        staticCount = staticInstances;
+    }
+
+    // starts a new set of culled views
+    void clearVisible()
+    {
+        visible.clear();
+        for (unsigned int v = 0; v < MAX_VIEWS; ++v)
+            for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+                viewFirst[v][l] = viewCount[v][l] = 0;
+        for (std::vector<InstanceData>& staging : lodStaging)
+            staging.clear();
+    }
+
+    // queues one culled instance of the view being built at the given LOD
+    void addVisible(const InstanceData& instance, unsigned int lod)
+    {
+        lodStaging[std::min(lod, lodCount - 1)].push_back(instance);
+    }
+
+    // closes the view: its queued instances become one contiguous range per LOD
+    void endView(unsigned int view)
+    {
+        for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+        {
+            viewFirst[view][l] = (unsigned int)visible.size();
+            viewCount[view][l] = (unsigned int)lodStaging[l].size();
+            visible.insert(visible.end(), lodStaging[l].begin(), lodStaging[l].end());
+            lodStaging[l].clear();
+        }
+    }
+
+    // triangles the view's culled instances add up to at their LODs
+    unsigned int viewTriangles(unsigned int view) const
+    {
+        unsigned int total = 0;
+        for (unsigned int l = 0; l < MESH_MAX_LODS; ++l)
+            total += lodTriangles[l] * viewCount[view][l];
+        return total;
+    }
+
+    void uploadVisible()
+    {
+        if (visible.empty())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, visibleVBO);
+        glBufferData(GL_ARRAY_BUFFER, visible.size() * sizeof(InstanceData), visible.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draws a subset of the instances of every mesh; textures go to units 0..n
+    void DrawInstanced(ShaderProgram& shader, InstanceSet set = INSTANCES_ALL)
+    {
+        unsigned int first = set == INSTANCES_DYNAMIC ? staticCount : 0;
+        unsigned int count = set == INSTANCES_STATIC ? staticCount : instanceCount - first;
+        drawMeshes(shader, instanceVBO, first, count, 0);
+    }
+
+    // draws the culled instances of one view, each LOD range with its own index range
+    void DrawVisible(ShaderProgram& shader, unsigned int view)
+    {
+        for (unsigned int l = 0; l < lodCount; ++l)
+            drawMeshes(shader, visibleVBO, viewFirst[view][l], viewCount[view][l], l);
+    }
+
+    // single non-instanced draw of one mesh, for shaders that take a model uniform
+    void DrawMesh(ShaderProgram& shader, unsigned int m, unsigned int lod = 0)
+    {
+        const RenderMesh& mesh = meshes[m];
+        for (unsigned int i = 0; i < mesh.textures.size(); ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, mesh.textures[i]);
+            textureCache().touch(mesh.textures[i]);
+        }
+        setPositionDecode(shader, mesh);
+        glBindVertexArray(mesh.VAO);
+        glDrawElements(GL_TRIANGLES, (GLsizei)mesh.lodIndexCount[lod], GL_UNSIGNED_INT, (void*)(mesh.lodFirst[lod] * sizeof(unsigned int)));
+        renderStats().drawCalls += 1;
+        renderStats().triangles += mesh.lodIndexCount[lod] / 3;
+        renderStats().textureBinds += mesh.textures.size();
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void Draw(ShaderProgram& shader, unsigned int lod = 0)
+    {
+        for (unsigned int m = 0; m < meshes.size(); ++m)
+            DrawMesh(shader, m, lod);
+    }
+
+    // positionOffset/positionScale of a quantized mesh; nothing for float meshes
+    static void setPositionDecode(ShaderProgram& shader, const RenderMesh& mesh)
+    {
+        if (!mesh.quantized)
+            return;
+        shader.setVec3(shader.location("positionOffset"), mesh.positionOffset);
+        shader.setVec3(shader.location("positionScale"), mesh.positionScale);
+    }
+
+private:
+    unsigned int visibleVBO;
+    unsigned int boundBuffer, boundFirst; // what the mesh VAOs' instance attributes point at
+    std::vector<InstanceData> lodStaging[MESH_MAX_LODS]; // the open view's instances, per LOD
+
+    void drawMeshes(ShaderProgram& shader, unsigned int buffer, unsigned int first, unsigned int count, unsigned int lod)
+    {
+        if (count == 0)
+            return;
+        for (const RenderMesh& mesh : meshes)
+        {
+            for (unsigned int i = 0; i < mesh.textures.size(); ++i)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, mesh.textures[i]);
+                textureCache().touch(mesh.textures[i]);
+            }
+            setPositionDecode(shader, mesh);
+            glBindVertexArray(mesh.VAO);
+            // no base instance in GL 3.3, so offset the attribute pointers instead
+            if (buffer != boundBuffer || first != boundFirst)
+                setInstancePointers(buffer, first);
+            glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)mesh.lodIndexCount[lod], GL_UNSIGNED_INT,
+                                    (void*)(mesh.lodFirst[lod] * sizeof(unsigned int)), count);
+            renderStats().drawCalls += 1;
+            renderStats().triangles += (uint64_t)(mesh.lodIndexCount[lod] / 3) * count;
+            renderStats().textureBinds += mesh.textures.size();
+        }
+        boundBuffer = buffer;
+        boundFirst = first;
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // mat4 world -> 4 vec4 attributes, mat3 normal -> 3 vec3 attributes, on the bound VAO
+    void setInstancePointers(unsigned int buffer, unsigned int first)
+    {
+        size_t base = first * sizeof(InstanceData);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (unsigned int c = 0; c < 4; ++c)
+            glVertexAttribPointer(INSTANCE_ATTRIB + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, world) + c * sizeof(glm::vec4)));
+        for (unsigned int c = 0; c < 3; ++c)
+            glVertexAttribPointer(INSTANCE_ATTRIB + 4 + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, normal) + c * sizeof(glm::vec3)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+// regroups the scene table by model, static entities first, and refreshes the
+// instance buffers of the models that had an entity move since the last call
+inline void updateInstances(SceneTable& scene, std::vector<RenderModel>& models)
+{
+    static std::vector<std::vector<InstanceData>> batches;
+    static std::vector<unsigned int> staticCounts;
+    batches.resize(models.size());
+    staticCounts.resize(models.size());
+    if (scene.modelDirty.size() < models.size())
+        scene.modelDirty.resize(models.size(), 0);
+
+    bool any = false;
+    for (unsigned int m = 0; m < models.size(); ++m)
+    {
+        batches[m].clear();
+        any = any || scene.modelDirty[m];
+    }
+    if (!any)
+        return;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (unsigned int i = 0; i < scene.size(); ++i)
+        {
+            unsigned int m = scene.model[i];
+            if (scene.modelDirty[m] && scene.dynamic[i] == pass)
+                batches[m].push_back({ scene.world[i], scene.normal[i] });
+        }
+        if (pass == 0)
+            for (unsigned int m = 0; m < models.size(); ++m)
+                staticCounts[m] = (unsigned int)batches[m].size();
+    }
+    for (unsigned int m = 0; m < models.size(); ++m)
+    {
+        if (!scene.modelDirty[m])
+            continue;
+        models[m].uploadInstances(batches[m], staticCounts[m]);
+        scene.modelDirty[m] = 0;
+    }
+}
+
+#endif
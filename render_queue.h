@@ -0,0 +1,166 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "asset_loader.h"
+#include "culling.h"
+#include "render_model.h"
+#include "scene.h"
+#include "shader_program.h"
+#include "texture_cache.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// one non-instanced draw of a single mesh of a placed entity
+struct DrawPacket
+{
+    uint64_t key;
+    unsigned int entity;
+    unsigned short mesh;
+    unsigned short lod;
+};
+
+// Sort key, most expensive state change in the highest bits so sorting groups by it:
+//   63..56 program | 55..40 texture set | 39..24 VAO | 23..0 view depth, front to back
+inline uint64_t drawKey(unsigned int program, unsigned int textureSet, unsigned int vao, float depth, float farPlane)
+{
+    float d = glm::clamp(depth / farPlane, 0.0f, 1.0f);
+    return ((uint64_t)(program & 0xFFu) << 56) | ((uint64_t)(textureSet & 0xFFFFu) << 40) |
+           ((uint64_t)(vao & 0xFFFFu) << 24) | (uint64_t)(d * 16777215.0f);
+}
+
+// Builds the draw list of a pass on worker threads, sorts it by key and submits it
+// with a backend that remembers the bound VAO and textures, so consecutive packets
+// sharing state only change what differs.
+class RenderQueue
+{
+public:
+    static const unsigned int CHUNK = 64; // entities per build job
+    static const unsigned int MAX_UNITS = 8; // texture units tracked by submit()
+
+    std::vector<DrawPacket> packets;
+
+    // accumulated by build()/submit() until the caller resets them
+    unsigned int meshesCulled;
+    unsigned int stateChanges; // VAO, active unit and texture binds issued
+    unsigned int stateChangesSkipped; // binds avoided because the state was already set
+
+    // threads = 0 picks one worker per core besides the calling thread
+    explicit RenderQueue(unsigned int threads = 0) : meshesCulled(0), stateChanges(0), stateChangesSkipped(0), pool(threads) {}
+
+    unsigned int workers() const { return pool.workers(); }
+
+    // One packet per mesh of each listed entity, dropping meshes outside the frustum
+    // when one is given, then sorted. lods, if given, holds the LOD of every entity
+    // by id. Entities are split into CHUNK-sized jobs that write their own packet
+    // lists, so workers never share a container.
+    void build(const SceneTable& scene, const std::vector<RenderModel>& models, const std::vector<unsigned int>& entities,
+               const Frustum* frustum, glm::vec3 eye, float farPlane, unsigned int program, const unsigned char* lods = nullptr)
+    {
+        unsigned int chunkCount = (unsigned int)((entities.size() + CHUNK - 1) / CHUNK);
+        if (chunks.size() < chunkCount)
+            chunks.resize(chunkCount);
+        chunkCulled.assign(chunkCount, 0);
+
+        pool.parallelFor(chunkCount, [&](unsigned int c)
+        {
+            std::vector<DrawPacket>& out = chunks[c];
+            out.clear();
+            size_t end = std::min(entities.size(), (size_t)(c + 1) * CHUNK);
+            for (size_t e = (size_t)c * CHUNK; e < end; ++e)
+            {
+                unsigned int i = entities[e];
+                const RenderModel& renderModel = models[scene.model[i]];
+                for (unsigned int m = 0; m < renderModel.meshes.size(); ++m)
+                {
+                    AABB bounds = renderModel.meshBounds[m].transformed(scene.world[i]);
+                    if (frustum && !frustum->intersects(bounds))
+                    {
+                        ++chunkCulled[c];
+                        continue;
+                    }
+                    const RenderMesh& mesh = renderModel.meshes[m];
+                    float depth = glm::length(bounds.center() - eye);
+                    unsigned short lod = lods ? (unsigned short)std::min<unsigned int>(lods[i], mesh.lodCount - 1) : 0;
+                    out.push_back({ drawKey(program, mesh.textureSet, mesh.VAO, depth, farPlane), i, (unsigned short)m, lod });
+                }
+            }
+        });
+
+        packets.clear();
+        for (unsigned int c = 0; c < chunkCount; ++c)
+        {
+            packets.insert(packets.end(), chunks[c].begin(), chunks[c].end());
+            meshesCulled += chunkCulled[c];
+        }
+        std::sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+    }
+
+    // Draws the packets in order with the shader already in use. Nothing is assumed
+    // about the state on entry; after the first packet only changed binds are issued.
+    void submit(ShaderProgram& shader, const SceneTable& scene, const std::vector<RenderModel>& models, bool normals)
+    {
+        GLint modelLocation = shader.location("model");
+        GLint normalLocation = normals ? shader.location("normalMatrix") : -1;
+        unsigned int boundVAO = ~0u;
+        unsigned int activeUnit = ~0u;
+        unsigned int boundTextures[MAX_UNITS];
+        for (unsigned int u = 0; u < MAX_UNITS; ++u)
+            boundTextures[u] = ~0u;
+
+        for (const DrawPacket& packet : packets)
+        {
+            const RenderMesh& mesh = models[scene.model[packet.entity]].meshes[packet.mesh];
+            for (unsigned int u = 0; u < mesh.textures.size() && u < MAX_UNITS; ++u)
+            {
+                if (boundTextures[u] == mesh.textures[u])
+                {
+                    ++stateChangesSkipped;
+                    continue;
+                }
+                if (activeUnit != u)
+                {
+                    glActiveTexture(GL_TEXTURE0 + u);
+                    activeUnit = u;
+                    ++stateChanges;
+                }
+                glBindTexture(GL_TEXTURE_2D, mesh.textures[u]);
+                textureCache().touch(mesh.textures[u]);
+                boundTextures[u] = mesh.textures[u];
+                ++stateChanges;
+                ++renderStats().textureBinds;
+            }
+            if (boundVAO != mesh.VAO)
+            {
+                glBindVertexArray(mesh.VAO);
+                boundVAO = mesh.VAO;
+                ++stateChanges;
+            }
+            else
+                ++stateChangesSkipped;
+
+            RenderModel::setPositionDecode(shader, mesh);
+            shader.setMat4(modelLocation, scene.world[packet.entity]);
+            if (normals)
+                shader.setMat3(normalLocation, scene.normal[packet.entity]);
+            glDrawElements(GL_TRIANGLES, (GLsizei)mesh.lodIndexCount[packet.lod], GL_UNSIGNED_INT,
+                           (void*)(mesh.lodFirst[packet.lod] * sizeof(unsigned int)));
+            renderStats().drawCalls += 1;
+            renderStats().triangles += mesh.lodIndexCount[packet.lod] / 3;
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    LazyThreadPool pool; // so a global queue starts no threads
+    std::vector<std::vector<DrawPacket>> chunks;
+    std::vector<unsigned int> chunkCulled;
+};
+
+#endif
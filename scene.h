@@ -0,0 +1,235 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "culling.h"
+
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define SCENE_SIMD 1
+#endif
+
+// Flat structure-of-arrays table of every object placed in the world.
+// Each entity is a translate * rotate * scale placement of a model id. World and
+// normal matrices are rebuilt once per frame for dirty entities only, and every
+// pass reads the cached results.
+class SceneTable
+{
+public:
+    // placement columns
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> rotX, rotY, rotZ, rotW; // unit quaternion
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<unsigned int> model; // index into the renderer's model list
+    std::vector<unsigned char> dirty;
+    std::vector<unsigned char> dynamic; // moves at runtime, kept out of cached shadows
+
+    // set per model id when one of its entities was rebuilt, cleared by the consumer
+    std::vector<unsigned char> modelDirty;
+
+    // derived columns, valid after update()
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat3> normal; // inverse-transpose of the upper 3x3 of world
+    std::vector<AABB> worldBounds;
+
+    // model-space bounds per model id, used to derive worldBounds
+    std::vector<AABB> modelBounds;
+
+    unsigned int size() const { return (unsigned int)model.size(); }
+
+    unsigned int add(unsigned int m, glm::vec3 position, glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3 scale = glm::vec3(1.0f))
+    {
+        posX.push_back(position.x); posY.push_back(position.y); posZ.push_back(position.z);
+        rotX.push_back(rotation.x); rotY.push_back(rotation.y); rotZ.push_back(rotation.z); rotW.push_back(rotation.w);
+        scaleX.push_back(scale.x); scaleY.push_back(scale.y); scaleZ.push_back(scale.z);
+        model.push_back(m);
+        dirty.push_back(1);
+        dynamic.push_back(0);
+        if (modelDirty.size() <= m)
+            modelDirty.resize(m + 1, 0);
+        world.push_back(glm::mat4(1.0f));
+        normal.push_back(glm::mat3(1.0f));
+        worldBounds.push_back(AABB());
+        if (modelBounds.size() <= m)
+            modelBounds.resize(m + 1);
+        return size() - 1;
+    }
+
+    // Removes an entity by moving the last one into its slot, so ids stay dense.
+    // Returns the old id of the entity that now lives at id; that is id itself
+    // when the removed entity was the last one and nothing moved.
+    unsigned int remove(unsigned int id)
+    {
+        unsigned int last = size() - 1;
+        modelDirty[model[id]] = 1;
+        if (id != last)
+        {
+            posX[id] = posX[last]; posY[id] = posY[last]; posZ[id] = posZ[last];
+            rotX[id] = rotX[last]; rotY[id] = rotY[last]; rotZ[id] = rotZ[last]; rotW[id] = rotW[last];
+            scaleX[id] = scaleX[last]; scaleY[id] = scaleY[last]; scaleZ[id] = scaleZ[last];
+            model[id] = model[last];
+            dirty[id] = dirty[last];
+            dynamic[id] = dynamic[last];
+            world[id] = world[last];
+            normal[id] = normal[last];
+            worldBounds[id] = worldBounds[last];
+            modelDirty[model[id]] = 1; // its instance moved within the model's buffer
+        }
+        posX.pop_back(); posY.pop_back(); posZ.pop_back();
+        rotX.pop_back(); rotY.pop_back(); rotZ.pop_back(); rotW.pop_back();
+        scaleX.pop_back(); scaleY.pop_back(); scaleZ.pop_back();
+        model.pop_back();
+        dirty.pop_back();
+        dynamic.pop_back();
+        world.pop_back();
+        normal.pop_back();
+        worldBounds.pop_back();
+        return id == last ? id : last;
+    }
+
+    void setPosition(unsigned int id, glm::vec3 position)
+    {
+        if (posX[id] == position.x && posY[id] == position.y && posZ[id] == position.z)
+            return;
+        posX[id] = position.x; posY[id] = position.y; posZ[id] = position.z;
+        dirty[id] = 1;
+    }
+
+    void setModelBounds(unsigned int m, const AABB& bounds)
+    {
+        if (modelBounds.size() <= m)
+            modelBounds.resize(m + 1);
+        modelBounds[m] = bounds;
+        for (unsigned int i = 0; i < size(); ++i)
+            if (model[i] == m)
+                dirty[i] = 1;
+    }
+
+    void setDynamic(unsigned int id, bool isDynamic)
+    {
+        dynamic[id] = isDynamic;
+        modelDirty[model[id]] = 1; // instance order depends on it
+    }
+
+    glm::vec3 position(unsigned int id) const { return glm::vec3(posX[id], posY[id], posZ[id]); }
+
+    // rebuild world/normal matrices of dirty entities, returns how many were rebuilt
+    unsigned int update()
+    {
+        unsigned int rebuilt = 0;
+        unsigned int n = size();
+        unsigned int i = 0;
+#ifdef SCENE_SIMD
+        for (; i + 4 <= n; i += 4)
+        {
+            unsigned int mask;
+            memcpy(&mask, &dirty[i], 4);
+            if (mask == 0)
+                continue;
+            updateBatch4(i);
+            rebuilt += 4;
+            for (unsigned int k = 0; k < 4; ++k)
+            {
+                worldBounds[i + k] = modelBounds[model[i + k]].transformed(world[i + k]);
+                modelDirty[model[i + k]] = 1;
+            }
+            memset(&dirty[i], 0, 4);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            if (!dirty[i])
+                continue;
+            updateOne(i);
+            ++rebuilt;
+            worldBounds[i] = modelBounds[model[i]].transformed(world[i]);
+            modelDirty[model[i]] = 1;
+            dirty[i] = 0;
+        }
+        return rebuilt;
+    }
+
+private:
+    void updateOne(unsigned int i)
+    {
+        float x = rotX[i], y = rotY[i], z = rotZ[i], w = rotW[i];
+        // columns of the rotation matrix
+        glm::vec3 r0(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y));
+        glm::vec3 r1(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x));
+        glm::vec3 r2(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y));
+
+        glm::mat4& m = world[i];
+        m[0] = glm::vec4(r0 * scaleX[i], 0.0f);
+        m[1] = glm::vec4(r1 * scaleY[i], 0.0f);
+        m[2] = glm::vec4(r2 * scaleZ[i], 0.0f);
+        m[3] = glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+
+        // (R * S)^-T = R * S^-1, no general inverse needed
+        glm::mat3& nm = normal[i];
+        nm[0] = r0 / scaleX[i];
+        nm[1] = r1 / scaleY[i];
+        nm[2] = r2 / scaleZ[i];
+    }
+
+#ifdef SCENE_SIMD
+    // same maths as updateOne for four consecutive entities, one per SSE lane
+    void updateBatch4(unsigned int i)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        __m128 x = _mm_loadu_ps(&rotX[i]), y = _mm_loadu_ps(&rotY[i]);
+        __m128 z = _mm_loadu_ps(&rotZ[i]), w = _mm_loadu_ps(&rotW[i]);
+        __m128 sx = _mm_loadu_ps(&scaleX[i]), sy = _mm_loadu_ps(&scaleY[i]), sz = _mm_loadu_ps(&scaleZ[i]);
+
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        // r<column><row>
+        __m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+        __m128 r01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+        __m128 r02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+        __m128 r10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+        __m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+        __m128 r12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+        __m128 r20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+        __m128 r21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+        __m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+        __m128 isx = _mm_div_ps(one, sx), isy = _mm_div_ps(one, sy), isz = _mm_div_ps(one, sz);
+        __m128 zero = _mm_setzero_ps();
+
+        // world columns: transpose lanes so each register holds one entity's column
+        __m128 c0a = _mm_mul_ps(r00, sx), c0b = _mm_mul_ps(r01, sx), c0c = _mm_mul_ps(r02, sx), c0d = zero;
+        __m128 c1a = _mm_mul_ps(r10, sy), c1b = _mm_mul_ps(r11, sy), c1c = _mm_mul_ps(r12, sy), c1d = zero;
+        __m128 c2a = _mm_mul_ps(r20, sz), c2b = _mm_mul_ps(r21, sz), c2c = _mm_mul_ps(r22, sz), c2d = zero;
+        __m128 c3a = _mm_loadu_ps(&posX[i]), c3b = _mm_loadu_ps(&posY[i]), c3c = _mm_loadu_ps(&posZ[i]), c3d = one;
+        _MM_TRANSPOSE4_PS(c0a, c0b, c0c, c0d);
+        _MM_TRANSPOSE4_PS(c1a, c1b, c1c, c1d);
+        _MM_TRANSPOSE4_PS(c2a, c2b, c2c, c2d);
+        _MM_TRANSPOSE4_PS(c3a, c3b, c3c, c3d);
+        __m128 cols[4][4] = {
+            { c0a, c1a, c2a, c3a }, { c0b, c1b, c2b, c3b },
+            { c0c, c1c, c2c, c3c }, { c0d, c1d, c2d, c3d } };
+        for (int k = 0; k < 4; ++k)
+            for (int c = 0; c < 4; ++c)
+                _mm_storeu_ps(&world[i + k][c][0], cols[k][c]);
+
+        // normal matrices: R * S^-1
+        float n[9][4];
+        _mm_storeu_ps(n[0], _mm_mul_ps(r00, isx)); _mm_storeu_ps(n[1], _mm_mul_ps(r01, isx)); _mm_storeu_ps(n[2], _mm_mul_ps(r02, isx));
+        _mm_storeu_ps(n[3], _mm_mul_ps(r10, isy)); _mm_storeu_ps(n[4], _mm_mul_ps(r11, isy)); _mm_storeu_ps(n[5], _mm_mul_ps(r12, isy));
+        _mm_storeu_ps(n[6], _mm_mul_ps(r20, isz)); _mm_storeu_ps(n[7], _mm_mul_ps(r21, isz)); _mm_storeu_ps(n[8], _mm_mul_ps(r22, isz));
+        for (int k = 0; k < 4; ++k)
+            for (int c = 0; c < 3; ++c)
+                normal[i + k][c] = glm::vec3(n[c * 3][k], n[c * 3 + 1][k], n[c * 3 + 2][k]);
+    }
+#endif
+};
+
+#endif
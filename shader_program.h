@@ -0,0 +1,351 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// one line of the startup report: which program, where it came from, how long it took
+struct ProgramLoadRecord
+{
+    std::string name;
+    bool cacheHit;
+    double milliseconds;
+};
+
+inline std::vector<ProgramLoadRecord>& programLoadLog()
+{
+    static std::vector<ProgramLoadRecord> log;
+    return log;
+}
+
+// set to false (--no-program-cache) to always compile from source
+inline bool& programCacheEnabled()
+{
+    static bool enabled = true;
+    return enabled;
+}
+
+inline void printProgramLoadReport(std::ostream& out)
+{
+    double total = 0.0;
+    unsigned int hits = 0;
+    out << "Shader programs:" << std::endl;
+    for (const ProgramLoadRecord& record : programLoadLog())
+    {
+        out << "  " << (record.cacheHit ? "hit  " : "miss ") << record.milliseconds << " ms  " << record.name << std::endl;
+        total += record.milliseconds;
+        hits += record.cacheHit ? 1 : 0;
+    }
+    out << "  " << hits << "/" << programLoadLog().size() << " from program cache, " << total << " ms total" << std::endl;
+}
+
+// Drop-in replacement for learnopengl's Shader that keeps a program binary cache
+// and caches uniform locations.
+// The linked binary is stored next to the vertex shader, tagged with an FNV-1a hash
+// of every source plus the GL vendor/renderer/version strings, and reloaded with
+// glProgramBinary on the next launch. Any change to the sources or the driver
+// misses the cache and falls back to compiling, which rewrites the file.
+// Optional space-separated defines are injected after each stage's #version line,
+// so one source file can build several variants.
+class ShaderProgram
+{
+public:
+    unsigned int ID;
+
+    ShaderProgram(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = std::string())
+        : ID(0)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        std::string vertexCode = injectDefines(readFile(vertexPath), defines);
+        std::string fragmentCode = injectDefines(readFile(fragmentPath), defines);
+        std::string geometryCode = geometryPath ? injectDefines(readFile(geometryPath), defines) : std::string();
+
+        std::string name = baseName(vertexPath) + "+" + baseName(fragmentPath) + (geometryPath ? "+" + baseName(geometryPath) : std::string());
+        if (!defines.empty())
+        {
+            name += "+";
+            for (char c : defines)
+                name += c == ' ' ? '+' : c;
+        }
+        std::string directory = std::string(vertexPath).substr(0, std::string(vertexPath).find_last_of('/') + 1);
+        std::string cachePath = directory + name + ".progbin";
+
+        uint64_t key = fnv1a(vertexCode, FNV_OFFSET);
+        key = fnv1a(fragmentCode, key);
+        key = fnv1a(geometryCode, key);
+        key = fnv1a(driverString(), key);
+
+        bool cacheHit = binarySupported() && programCacheEnabled() && loadBinary(cachePath, key);
+        if (!cacheHit)
+        {
+            compile(vertexCode, fragmentCode, geometryCode);
+            if (binarySupported() && programCacheEnabled())
+                saveBinary(cachePath, key);
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        programLoadLog().push_back({ name, cacheHit, ms });
+    }
+
+    void use() const { glUseProgram(ID); }
+
+    // location of an active uniform, looked up once per name and cached; -1 if absent
+    GLint location(const std::string& name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = locations.find(name);
+        if (it != locations.end())
+            return it->second;
+        GLint found = glGetUniformLocation(ID, name.c_str());
+        locations[name] = found;
+        return found;
+    }
+
+    // the same for a string literal, found by its address so per-frame lookups
+    // never build a std::string; other names go through the string cache once
+    GLint location(const char* name) const
+    {
+        for (const std::pair<const char*, GLint>& entry : literalLocations)
+            if (entry.first == name)
+                return entry.second;
+        GLint found = location(std::string(name));
+        literalLocations.push_back(std::make_pair(name, found));
+        return found;
+    }
+
+    // glUniform* calls made through any program since the last reset
+    static unsigned int& uniformCalls()
+    {
+        static unsigned int calls = 0;
+        return calls;
+    }
+
+    void setBool(const std::string& name, bool value) const { setInt(location(name), (int)value); }
+    void setInt(const std::string& name, int value) const { setInt(location(name), value); }
+    void setFloat(const std::string& name, float value) const { setFloat(location(name), value); }
+    void setVec2(const std::string& name, const glm::vec2& value) const { setVec2(location(name), value); }
+    void setVec3(const std::string& name, const glm::vec3& value) const { setVec3(location(name), value); }
+    void setVec3(const std::string& name, float x, float y, float z) const { setVec3(location(name), glm::vec3(x, y, z)); }
+    void setVec4(const std::string& name, const glm::vec4& value) const { setVec4(location(name), value); }
+    void setMat3(const std::string& name, const glm::mat3& mat) const { setMat3(location(name), mat); }
+    void setMat4(const std::string& name, const glm::mat4& mat) const { setMat4(location(name), mat); }
+
+    // string literals take the address-keyed cache; names built at run time must go
+    // through the std::string overloads above, since the address is the key
+    void setBool(const char* name, bool value) const { setInt(location(name), (int)value); }
+    void setInt(const char* name, int value) const { setInt(location(name), value); }
+    void setFloat(const char* name, float value) const { setFloat(location(name), value); }
+    void setVec2(const char* name, const glm::vec2& value) const { setVec2(location(name), value); }
+    void setVec3(const char* name, const glm::vec3& value) const { setVec3(location(name), value); }
+    void setVec3(const char* name, float x, float y, float z) const { setVec3(location(name), glm::vec3(x, y, z)); }
+    void setVec4(const char* name, const glm::vec4& value) const { setVec4(location(name), value); }
+    void setMat3(const char* name, const glm::mat3& mat) const { setMat3(location(name), mat); }
+    void setMat4(const char* name, const glm::mat4& mat) const { setMat4(location(name), mat); }
+
+    // by location, for hot loops that look the location up once
+    void setInt(GLint loc, int value) const { ++uniformCalls(); glUniform1i(loc, value); }
+    void setFloat(GLint loc, float value) const { ++uniformCalls(); glUniform1f(loc, value); }
+    void setVec2(GLint loc, const glm::vec2& value) const { ++uniformCalls(); glUniform2fv(loc, 1, &value[0]); }
+    void setVec3(GLint loc, const glm::vec3& value) const { ++uniformCalls(); glUniform3fv(loc, 1, &value[0]); }
+    void setVec4(GLint loc, const glm::vec4& value) const { ++uniformCalls(); glUniform4fv(loc, 1, &value[0]); }
+    void setMat3(GLint loc, const glm::mat3& mat) const { ++uniformCalls(); glUniformMatrix3fv(loc, 1, GL_FALSE, &mat[0][0]); }
+    void setMat4(GLint loc, const glm::mat4& mat) const { ++uniformCalls(); glUniformMatrix4fv(loc, 1, GL_FALSE, &mat[0][0]); }
+
+private:
+    mutable std::unordered_map<std::string, GLint> locations;
+    mutable std::vector<std::pair<const char*, GLint>> literalLocations;
+
+    static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    static const uint32_t CACHE_MAGIC = 0x42505247; // "GRPB"
+
+    struct CacheHeader
+    {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t key;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    static uint64_t fnv1a(const std::string& data, uint64_t hash)
+    {
+        for (unsigned char c : data)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        // separator, so moving text between sources changes the key
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+        return hash;
+    }
+
+    static std::string readFile(const char* path)
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+            return std::string();
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        return stream.str();
+    }
+
+    static std::string injectDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty() || source.empty())
+            return source;
+        std::string block;
+        std::istringstream words(defines);
+        std::string word;
+        while (words >> word)
+            block += "#define " + word + "\n";
+        size_t versionEnd = source.find('\n') + 1;
+        // #line keeps compiler messages pointing at the real source lines
+        return source.substr(0, versionEnd) + block + "#line 2\n" + source.substr(versionEnd);
+    }
+
+    static std::string baseName(const char* path)
+    {
+        std::string name(path);
+        size_t slash = name.find_last_of('/');
+        if (slash != std::string::npos)
+            name = name.substr(slash + 1);
+        size_t dot = name.find_last_of('.');
+        return dot == std::string::npos ? name : name.substr(0, dot);
+    }
+
+    static std::string driverString()
+    {
+        const char* vendor = (const char*)glGetString(GL_VENDOR);
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        const char* version = (const char*)glGetString(GL_VERSION);
+        return std::string(vendor ? vendor : "") + "\n" + (renderer ? renderer : "") + "\n" + (version ? version : "");
+    }
+
+    // GL 4.1 / ARB_get_program_binary, and at least one binary format
+    static bool binarySupported()
+    {
+        if (!glGetProgramBinary || !glProgramBinary)
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    bool loadBinary(const std::string& path, uint64_t key)
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        if (!file)
+            return false;
+        CacheHeader header;
+        if (!file.read((char*)&header, sizeof(header)) || header.magic != CACHE_MAGIC || header.key != key)
+            return false;
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+            return false;
+
+        ID = glCreateProgram();
+        glProgramBinary(ID, header.format, binary.data(), (GLsizei)binary.size());
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // the driver rejected it (e.g. updated without changing its strings)
+            glDeleteProgram(ID);
+            ID = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void saveBinary(const std::string& path, uint64_t key)
+    {
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, NULL, &format, binary.data());
+
+        CacheHeader header = { CACHE_MAGIC, format, key, (uint32_t)length, 0 };
+        std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.write((const char*)&header, sizeof(header)) || !file.write(binary.data(), binary.size()))
+        {
+            file.close();
+            remove(path.c_str());
+        }
+    }
+
+    void compile(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode)
+    {
+        unsigned int vertex = compileStage(GL_VERTEX_SHADER, vertexCode, "VERTEX");
+        unsigned int fragment = compileStage(GL_FRAGMENT_SHADER, fragmentCode, "FRAGMENT");
+        unsigned int geometry = geometryCode.empty() ? 0 : compileStage(GL_GEOMETRY_SHADER, geometryCode, "GEOMETRY");
+
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        if (geometry)
+            glAttachShader(ID, geometry);
+        if (binarySupported())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (geometry)
+            glDeleteShader(geometry);
+    }
+
+    static unsigned int compileStage(GLenum type, const std::string& code, const std::string& typeName)
+    {
+        const char* source = code.c_str();
+        unsigned int shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        checkCompileErrors(shader, typeName);
+        return shader;
+    }
+
+    static void checkCompileErrors(GLuint object, const std::string& type)
+    {
+        GLint success;
+        GLchar infoLog[1024];
+        if (type != "PROGRAM")
+        {
+            glGetShaderiv(object, GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(object, 1024, NULL, infoLog);
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+            }
+        }
+        else
+        {
+            glGetProgramiv(object, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                glGetProgramInfoLog(object, 1024, NULL, infoLog);
+                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#version 330 core
+out vec2 FragMoments;
+
+uniform samplerCube momentsMap;
+uniform int face;
+uniform vec2 direction; // (1, 0) or (0, 1), in face texels
+uniform float size;
+
+// binomial weights, 7 taps
+const float weights[4] = float[](20.0 / 64.0, 15.0 / 64.0, 6.0 / 64.0, 1.0 / 64.0);
+
+vec3 faceDirection(int f, vec2 st)
+{
+    vec2 uv = st * 2.0 - 1.0;
+    if (f == 0) return vec3( 1.0, -uv.y, -uv.x);
+    if (f == 1) return vec3(-1.0, -uv.y,  uv.x);
+    if (f == 2) return vec3( uv.x,  1.0,  uv.y);
+    if (f == 3) return vec3( uv.x, -1.0, -uv.y);
+    if (f == 4) return vec3( uv.x, -uv.y,  1.0);
+    return vec3(-uv.x, -uv.y, -1.0);
+}
+
+void main()
+{
+    // taps past the face edge turn into directions on the neighbouring face,
+    // so the blur crosses cube seams instead of clamping at them
+    vec2 st = gl_FragCoord.xy / size;
+    vec2 moments = weights[0] * textureLod(momentsMap, faceDirection(face, st), 0.0).rg;
+    for (int i = 1; i < 4; ++i)
+    {
+        vec2 offset = direction * float(i) / size;
+        moments += weights[i] * textureLod(momentsMap, faceDirection(face, st + offset), 0.0).rg;
+        moments += weights[i] * textureLod(momentsMap, faceDirection(face, st - offset), 0.0).rg;
+    }
+    FragMoments = moments;
+}
@@ -0,0 +1,48 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// per-instance, filled from the model's instance buffer (see render_model.h)
+layout (location = 7) in mat4 aModel;
+
+uniform int face; // cubemap face being drawn; slot * 6 + face in the atlas
+
+layout (std140) uniform Light
+{
+    mat4 shadowMatrices[6]; // light projection * view per cubemap face
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightStrength;
+    bool shadows;
+    int shadowFilter; // 0 = PCF, 1 = VSM, 2 = ESM
+    float esmExponent;
+    int shadowSamples; // PCF taps, lowered by the quality governor
+};
+
+#ifdef SHADOW_ATLAS
+// floodlight faces in the shadow atlas, six per slot (see shadow_atlas.h)
+layout (std140) uniform ShadowAtlas
+{
+    mat4 atlasMatrices[60]; // light projection * view per face, 6 * MAX_SHADOWED_LIGHTS
+    vec4 atlasLights[10];   // position, radius
+};
+#endif
+
+out vec4 FragPos;
+
+#ifdef QUANTIZED_VERTICES
+// snorm16 positions span the mesh bounds (see mesh_optimize.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+vec3 position() { return positionOffset + positionScale * aPos; }
+#else
+vec3 position() { return aPos; }
+#endif
+
+void main()
+{
+    FragPos = aModel * vec4(position(), 1.0);
+#ifdef SHADOW_ATLAS
+    gl_Position = atlasMatrices[face] * FragPos;
+#else
+    gl_Position = shadowMatrices[face] * FragPos;
+#endif
+}
@@ -1,15 +1,41 @@
 #version 330 core
 in vec4 FragPos;
 
-uniform vec3 lightPos;
-uniform float far_plane;
+layout (std140) uniform Light
+{
+    mat4 shadowMatrices[6]; // light projection * view per cubemap face
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightStrength;
+    bool shadows;
+    int shadowFilter; // 0 = PCF, 1 = VSM, 2 = ESM
+    float esmExponent;
+    int shadowSamples; // PCF taps, lowered by the quality governor
+};
+
+#ifdef SHADOW_ATLAS
+uniform int face; // slot * 6 + cubemap face
+
+// floodlight faces in the shadow atlas, six per slot (see shadow_atlas.h)
+layout (std140) uniform ShadowAtlas
+{
+    mat4 atlasMatrices[60]; // light projection * view per face, 6 * MAX_SHADOWED_LIGHTS
+    vec4 atlasLights[10];   // position, radius
+};
+#endif
 
 void main()
 {
+#ifdef SHADOW_ATLAS
+    // floodlight faces end at the light's radius
+    vec4 light = atlasLights[face / 6];
+    float lightDistance = length(FragPos.xyz - light.xyz) / light.w;
+#else
     float lightDistance = length(FragPos.xyz - lightPos);
     
     // map to [0;1] range by dividing by far_plane
     lightDistance = lightDistance / far_plane;
+#endif
     
     // write this as modified depth
     gl_FragDepth = lightDistance;
@@ -0,0 +1,38 @@
+#version 330 core
+out vec2 FragMoments;
+
+uniform samplerCube depthMap; // linear light distance / far_plane
+uniform int face;             // cubemap face being written
+uniform int shadowFilter;     // 1 = variance (d, d^2), 2 = exponential exp(c * d)
+uniform float esmExponent;
+uniform float size;           // moments face resolution
+uniform int taps;             // depth texels averaged per axis (depth size / moments size)
+
+// direction through texel coordinate st of a cubemap face (GL spec table 8.19 inverted)
+vec3 faceDirection(int f, vec2 st)
+{
+    vec2 uv = st * 2.0 - 1.0;
+    if (f == 0) return vec3( 1.0, -uv.y, -uv.x);
+    if (f == 1) return vec3(-1.0, -uv.y,  uv.x);
+    if (f == 2) return vec3( uv.x,  1.0,  uv.y);
+    if (f == 3) return vec3( uv.x, -1.0, -uv.y);
+    if (f == 4) return vec3( uv.x, -uv.y,  1.0);
+    return vec3(-uv.x, -uv.y, -1.0);
+}
+
+void main()
+{
+    // box-downsample the depth face: average the moments, not the depths
+    vec2 moments = vec2(0.0);
+    vec2 corner = gl_FragCoord.xy - 0.5;
+    for (int y = 0; y < taps; ++y)
+    {
+        for (int x = 0; x < taps; ++x)
+        {
+            vec2 st = (corner + (vec2(x, y) + 0.5) / float(taps)) / size;
+            float depth = texture(depthMap, faceDirection(face, st)).r;
+            moments += shadowFilter == 2 ? vec2(exp(esmExponent * depth), 0.0) : vec2(depth, depth * depth);
+        }
+    }
+    FragMoments = moments / float(taps * taps);
+}
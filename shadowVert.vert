@@ -3,7 +3,16 @@ layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
 
+#ifdef QUANTIZED_VERTICES
+// snorm16 positions span the mesh bounds (see mesh_optimize.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+vec3 position() { return positionOffset + positionScale * aPos; }
+#else
+vec3 position() { return aPos; }
+#endif
+
 void main()
 {
-    gl_Position = model * vec4(aPos, 1.0);
+    gl_Position = model * vec4(position(), 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+// per-instance, filled from the model's instance buffer (see render_model.h)
+layout (location = 7) in mat4 aModel;
+
+#ifdef QUANTIZED_VERTICES
+// snorm16 positions span the mesh bounds (see mesh_optimize.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+vec3 position() { return positionOffset + positionScale * aPos; }
+#else
+vec3 position() { return aPos; }
+#endif
+
+void main()
+{
+    gl_Position = aModel * vec4(position(), 1.0);
+}
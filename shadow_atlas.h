@@ -0,0 +1,117 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "clustered_lights.h"
+#include "culling.h"
+#include "uniform_blocks.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// tiles per side of the atlas; mainFrag.frag's AtlasShadow() uses the same number
+const unsigned int SHADOW_ATLAS_TILES = 8;
+
+// the six 90 degree views of a point light in GL cubemap face order (+X, -X, +Y, -Y, +Z, -Z)
+inline void cubeFaceMatrices(glm::vec3 position, float nearPlane, float farPlane, glm::mat4 out[6])
+{
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+    out[0] = projection * glm::lookAt(position, position + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    out[1] = projection * glm::lookAt(position, position + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    out[2] = projection * glm::lookAt(position, position + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    out[3] = projection * glm::lookAt(position, position + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+    out[4] = projection * glm::lookAt(position, position + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    out[5] = projection * glm::lookAt(position, position + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+}
+
+// One depth texture shared by the floodlight shadows. Only the few lights that
+// matter most this frame get a slot: six square tiles, one per cube face, each
+// holding the distance to the light over its radius like the main shadow
+// cubemap. The rest of the lights stay unshadowed. The texture compares in
+// hardware, so a lookup is one bilinear-filtered sampler2DShadow tap.
+class ShadowAtlas
+{
+public:
+    unsigned int texture;
+    unsigned int fbo;
+    unsigned int size, tileSize;
+    std::vector<unsigned int> shadowed; // light index of each slot
+
+    // no GL calls here; the texture is allocated by the first assign()
+    explicit ShadowAtlas(unsigned int size = 4096) : texture(0), fbo(0), size(size), tileSize(size / SHADOW_ATLAS_TILES) {}
+
+    // Ranks the lights and gives the first `slots` of them a slot, writing every
+    // light's shadowSlot and the slots' face matrices into block. A light ranks by
+    // its brightest channel times radius squared over its squared distance from
+    // the eye, so near, bright, wide lights win; lights whose sphere misses the
+    // view never get a slot.
+    void assign(std::vector<PointLight>& lights, const Frustum& view, glm::vec3 eye, unsigned int slots, AtlasBlock& block)
+    {
+        if (texture == 0)
+            allocate();
+        slots = std::min(slots, MAX_SHADOWED_LIGHTS);
+        ranking.clear();
+        for (unsigned int i = 0; i < lights.size(); ++i)
+        {
+            PointLight& light = lights[i];
+            light.shadowSlot = -1;
+            glm::vec3 r(light.radius);
+            if (!view.intersects(AABB(light.position - r, light.position + r)))
+                continue;
+            glm::vec3 d = light.position - eye;
+            float brightness = std::max(light.color.x, std::max(light.color.y, light.color.z));
+            ranking.push_back(std::make_pair(brightness * light.radius * light.radius / std::max(glm::dot(d, d), 0.01f), i));
+        }
+        unsigned int count = std::min(slots, (unsigned int)ranking.size());
+        std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end(),
+                          [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b) { return a.first > b.first; });
+
+        shadowed.resize(count);
+        for (unsigned int slot = 0; slot < count; ++slot)
+        {
+            PointLight& light = lights[ranking[slot].second];
+            light.shadowSlot = (int)slot;
+            shadowed[slot] = ranking[slot].second;
+            cubeFaceMatrices(light.position, NEAR_PLANE, light.radius, &block.faceMatrices[slot * 6]);
+            block.lights[slot] = glm::vec4(light.position, light.radius);
+        }
+    }
+
+    // viewport of one face tile of a slot, for drawing into the bound atlas FBO
+    void setViewport(unsigned int slot, unsigned int face) const
+    {
+        unsigned int tile = slot * 6 + face;
+        glViewport((tile % SHADOW_ATLAS_TILES) * tileSize, (tile / SHADOW_ATLAS_TILES) * tileSize, tileSize, tileSize);
+    }
+
+private:
+    static constexpr float NEAR_PLANE = 0.05f;
+
+    std::vector<std::pair<float, unsigned int>> ranking; // importance, light index
+
+    void allocate()
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// (re)allocates the six depth faces of a shadow cubemap
+inline void allocateShadowCubemap(unsigned int cubemap, unsigned int width, unsigned int height)
+{
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    for (unsigned int i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+}
+
+// Static-only depth cubemap for the point light.
+// It is re-rendered only when the light has moved further than the threshold
+// since the last rebuild. Each frame its faces are blitted into the live
+// shadow cubemap, and the moving objects are drawn on top of that copy.
+class ShadowCache
+{
+public:
+    unsigned int cubemap;
+    unsigned int fbo;
+    float threshold;
+    glm::vec3 lightPos;
+    bool valid;
+    unsigned int rebuilds;
+
+    ShadowCache(unsigned int width, unsigned int height, float threshold)
+        : threshold(threshold), lightPos(0.0f), valid(false), rebuilds(0), width(width), height(height)
+    {
+        glGenTextures(1, &cubemap);
+        allocateShadowCubemap(cubemap, width, height);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubemap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // single-face FBOs used as blit source/destination
+        glGenFramebuffers(1, &readFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, readFBO);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glGenFramebuffers(1, &drawFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, drawFBO);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    bool needsRebuild(const glm::vec3& light) const
+    {
+        return !valid || glm::length(light - lightPos) > threshold;
+    }
+
+    void invalidate() { valid = false; }
+
+    // new face size; the contents are gone, so the next frame rebuilds
+    void resize(unsigned int w, unsigned int h)
+    {
+        width = w;
+        height = h;
+        allocateShadowCubemap(cubemap, width, height);
+        valid = false;
+    }
+
+    // binds the static FBO cleared and ready for the static geometry draw
+    void beginRebuild(const glm::vec3& light)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        lightPos = light;
+        valid = true;
+        ++rebuilds;
+    }
+
+    // copies the selected faces (bit i = face i) of the static cubemap into target
+    void copyFaces(unsigned int target, unsigned int faceMask)
+    {
+        if (faceMask == 0)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            if (!(faceMask & (1u << i)))
+                continue;
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemap, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, target, 0);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+private:
+    unsigned int width, height;
+    unsigned int readFBO, drawFBO;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef SHADOW_FILTER_H
+#define SHADOW_FILTER_H
+
+#include <glad/glad.h>
+
+#include "shader_program.h"
+#include "trace.h"
+
+// how the main pass turns the shadow cubemap into a shadow factor
+enum ShadowFilter { SHADOW_PCF, SHADOW_VSM, SHADOW_ESM, SHADOW_FILTER_COUNT };
+
+inline const char* shadowFilterName(int filter)
+{
+    static const char* names[SHADOW_FILTER_COUNT] = { "pcf", "vsm", "esm" };
+    return names[filter];
+}
+
+// Prefiltered shadow cubemap for variance/exponential shadows.
+// The depth cubemap is box-downsampled into a moments cubemap (the moments are
+// averaged, not the depths), blurred separably per face and mipmapped, so the
+// main pass gets a soft shadow from one trilinear tap. Only the faces whose
+// depth changed this frame are downsampled again, into an unblurred copy kept
+// for every face. The blur taps cross cube seams, so each pass also redoes the
+// faces next to the ones its input changed on, always reading consistent,
+// once-blurred data.
+class ShadowPrefilter
+{
+public:
+    unsigned int moments; // RG32F cubemap sampled by the main pass
+    unsigned int size;
+    float esmExponent;
+
+    ShadowPrefilter(unsigned int depthSize, unsigned int size, float esmExponent = 80.0f)
+        : size(size), esmExponent(esmExponent), depthSize(depthSize), lastFilter(SHADOW_PCF)
+    {
+        moments = createMoments();
+        raw = createMoments();
+        scratch = createMoments();
+        glGenFramebuffers(1, &fbo);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    // new depth and moments sizes; every face is rebuilt on the next update()
+    void resize(unsigned int newDepthSize, unsigned int newSize)
+    {
+        depthSize = newDepthSize;
+        size = newSize;
+        allocateMoments(moments);
+        allocateMoments(raw);
+        allocateMoments(scratch);
+        lastFilter = SHADOW_FILTER_COUNT;
+    }
+
+    // rebuilds the selected faces (bit i = face i) of the moments cubemap from depthCubemap
+    void update(unsigned int depthCubemap, unsigned int faceMask, ShadowFilter filter, ShaderProgram& momentsShader, ShaderProgram& blurShader)
+    {
+        if (filter != lastFilter)
+            faceMask = 0x3F; // moments of the other filter, or of the old size, are useless
+        lastFilter = filter;
+        if (faceMask == 0)
+            return;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, size, size);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(emptyVAO);
+        glActiveTexture(GL_TEXTURE0);
+
+        // depth -> unblurred moments, downsampled
+        momentsShader.use();
+        momentsShader.setInt("depthMap", 0);
+        momentsShader.setInt("shadowFilter", filter);
+        momentsShader.setFloat("esmExponent", esmExponent);
+        momentsShader.setFloat("size", (float)size);
+        momentsShader.setInt("taps", depthSize > size ? (int)(depthSize / size) : 1);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+        renderStats().textureBinds += 1;
+        drawFaces(momentsShader, raw, faceMask);
+
+        // separable blur: raw -> scratch horizontally, scratch -> moments vertically;
+        // each pass widens the set by the faces that sample its changed input
+        unsigned int horizontalMask = withNeighbours(faceMask);
+        unsigned int verticalMask = withNeighbours(horizontalMask);
+        blurShader.use();
+        blurShader.setInt("momentsMap", 0);
+        blurShader.setFloat("size", (float)size);
+        blurShader.setVec2("direction", glm::vec2(1.0f, 0.0f));
+        glBindTexture(GL_TEXTURE_CUBE_MAP, raw);
+        renderStats().textureBinds += 1;
+        drawFaces(blurShader, scratch, horizontalMask);
+        blurShader.setVec2("direction", glm::vec2(0.0f, 1.0f));
+        glBindTexture(GL_TEXTURE_CUBE_MAP, scratch);
+        renderStats().textureBinds += 1;
+        drawFaces(blurShader, moments, verticalMask);
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, moments);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+    }
+
+private:
+    unsigned int raw; // unblurred moments of every face
+    unsigned int scratch;
+    unsigned int fbo;
+    unsigned int emptyVAO;
+    unsigned int depthSize;
+    ShadowFilter lastFilter;
+
+    unsigned int createMoments()
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        allocateMoments(texture);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void allocateMoments(unsigned int texture)
+    {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, NULL);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    }
+
+    // the faces plus every face sharing an edge with one, i.e. all but their opposites
+    // (faces come in +/- pairs, so face i's opposite is i ^ 1)
+    static unsigned int withNeighbours(unsigned int faceMask)
+    {
+        unsigned int mask = faceMask;
+        for (unsigned int i = 0; i < 6; ++i)
+            if (faceMask & (1u << i))
+                mask |= 0x3Fu & ~(1u << (i ^ 1u));
+        return mask;
+    }
+
+    void drawFaces(ShaderProgram& shader, unsigned int target, unsigned int faceMask)
+    {
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            if (!(faceMask & (1u << i)))
+                continue;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, target, 0);
+            shader.setInt("face", (int)i);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            renderStats().drawCalls += 1;
+            renderStats().triangles += 1;
+        }
+    }
+};
+
+#endif
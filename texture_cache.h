@@ -0,0 +1,279 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "asset_loader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide cache of the mesh textures, keyed by a hash of their decoded
+// pixels, so models that ship the same image under different paths share one
+// GL texture. Resident bytes are tracked against a budget. When the cache goes
+// over it, textures not bound this frame or the last lose their top mip level,
+// least recently used first and one level per texture per round, so every cold
+// texture gets blurrier before any of them is reduced to a few texels. The
+// texture keeps its GL name, so meshes never notice. Binding a reduced texture
+// queues its file for decoding again, and restore() puts the full image back.
+class TextureCache
+{
+public:
+    static const unsigned int RESTORE_DELAY = 30; // frames a reduced texture waits after losing a level before it may reload
+
+    size_t budgetBytes; // 0 = unlimited
+    size_t residentBytes; // every cached level plus the pinned textures
+    uint64_t hits, misses; // acquire() lookups
+    uint64_t mipsDropped, reloads;
+
+    TextureCache() : budgetBytes(0), residentBytes(0), hits(0), misses(0), mipsDropped(0), reloads(0), frame(0), placeholderTexture(0), copyFBOs{ 0, 0 } {}
+
+    // the texture holding these pixels, uploaded with a full mip chain on the first
+    // request; path is where to decode them again after levels have been dropped
+    unsigned int acquire(const DecodedImage& image, const std::string& path)
+    {
+        std::unordered_map<uint64_t, unsigned int>::iterator it = byHash.find(image.hash);
+        if (it != byHash.end())
+        {
+            ++hits;
+            touch(entries[it->second].texture);
+            return entries[it->second].texture;
+        }
+        ++misses;
+        Entry entry;
+        entry.hash = image.hash;
+        entry.texture = uploader.upload2D(image);
+        entry.path = path;
+        entry.width = image.width;
+        entry.height = image.height;
+        entry.channels = image.channels;
+        entry.dropped = 0;
+        entry.lastUsed = frame;
+        entry.droppedAt = 0;
+        entry.reloading = false;
+        entry.bytes = chainBytes(entry.width, entry.height, entry.channels);
+        residentBytes += entry.bytes;
+        byHash[entry.hash] = (unsigned int)entries.size();
+        byTexture[entry.texture] = (unsigned int)entries.size();
+        entries.push_back(entry);
+        enforceBudget();
+        return entry.texture;
+    }
+
+    // decodes and acquires synchronously; the placeholder if the file does not decode
+    unsigned int load(const std::string& path)
+    {
+        DecodedImage image;
+        if (!decodeImage(path, image))
+            return placeholder();
+        return acquire(image, path);
+    }
+
+    // 1x1 grey, shared by everything that failed to load
+    unsigned int placeholder()
+    {
+        if (placeholderTexture == 0)
+            placeholderTexture = createPlaceholderTexture();
+        return placeholderTexture;
+    }
+
+    // GPU memory the cache does not manage, like the skybox, counted towards the budget
+    void pin(size_t bytes) { residentBytes += bytes; }
+
+    // marks a texture as used this frame; a reduced one is queued for reloading
+    void touch(unsigned int texture)
+    {
+        std::unordered_map<unsigned int, unsigned int>::iterator it = byTexture.find(texture);
+        if (it == byTexture.end())
+            return;
+        Entry& entry = entries[it->second];
+        entry.lastUsed = frame;
+        if (entry.dropped > 0 && !entry.reloading && frame - entry.droppedAt >= RESTORE_DELAY)
+        {
+            entry.reloading = true;
+            restoreQueue.push_back(it->second);
+        }
+    }
+
+    void beginFrame() { ++frame; }
+
+    // Hands the reloads queued by touch() to the loader; the decoded images come
+    // back through AssetLoader::takeImage() with a GL_TEXTURE_2D target.
+    void requestReloads(AssetLoader& loader)
+    {
+        for (unsigned int e : restoreQueue)
+            loader.loadImage(entries[e].texture, GL_TEXTURE_2D, entries[e].path);
+        restoreQueue.clear();
+    }
+
+    // puts a reloaded image back at full size, then trims other textures to the budget
+    void restore(unsigned int texture, const DecodedImage& image)
+    {
+        std::unordered_map<unsigned int, unsigned int>::iterator it = byTexture.find(texture);
+        if (it == byTexture.end())
+            return;
+        Entry& entry = entries[it->second];
+        entry.reloading = false;
+        if (!image.ok() || image.hash != entry.hash) // the file changed on disk; keep what we have
+            return;
+        uploader.uploadTarget(texture, GL_TEXTURE_2D, GL_TEXTURE_2D, image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        residentBytes += chainBytes(entry.width, entry.height, entry.channels) - entry.bytes;
+        entry.bytes = chainBytes(entry.width, entry.height, entry.channels);
+        entry.dropped = 0;
+        ++reloads;
+        enforceBudget();
+    }
+
+    unsigned int textures() const { return (unsigned int)entries.size(); }
+
+    // textures currently below their full size
+    unsigned int reduced() const
+    {
+        unsigned int count = 0;
+        for (const Entry& entry : entries)
+            count += entry.dropped > 0 ? 1 : 0;
+        return count;
+    }
+
+    double hitRate() const { return hits + misses > 0 ? (double)hits / (double)(hits + misses) : 0.0; }
+
+    // Drops top mip levels of textures not bound in the last two frames until the
+    // cache fits the budget or nothing cold is left to shrink. Returns the levels dropped.
+    unsigned int enforceBudget()
+    {
+        if (budgetBytes == 0 || residentBytes <= budgetBytes)
+            return 0;
+        coldOrder.clear();
+        for (unsigned int e = 0; e < entries.size(); ++e)
+            if (entries[e].lastUsed + 1 < frame && !entries[e].reloading)
+                coldOrder.push_back(e);
+        std::sort(coldOrder.begin(), coldOrder.end(), [this](unsigned int a, unsigned int b) { return entries[a].lastUsed < entries[b].lastUsed; });
+
+        unsigned int dropped = 0;
+        bool shrank = true;
+        while (residentBytes > budgetBytes && shrank)
+        {
+            shrank = false;
+            for (unsigned int e : coldOrder)
+            {
+                if (residentBytes <= budgetBytes)
+                    break;
+                if (dropTopLevel(entries[e]))
+                {
+                    shrank = true;
+                    ++dropped;
+                }
+            }
+        }
+        return dropped;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        unsigned int texture;
+        std::string path;
+        int width, height, channels; // of the full image
+        unsigned int dropped; // top levels currently missing
+        uint64_t lastUsed, droppedAt; // frame numbers
+        bool reloading;
+        size_t bytes;
+    };
+
+    std::vector<Entry> entries;
+    std::unordered_map<uint64_t, unsigned int> byHash; // entry index
+    std::unordered_map<unsigned int, unsigned int> byTexture;
+    std::vector<unsigned int> restoreQueue;
+    std::vector<unsigned int> coldOrder;
+    uint64_t frame;
+    unsigned int placeholderTexture;
+    unsigned int copyFBOs[2]; // read and draw framebuffers for dropTopLevel()'s blits
+    TextureUploader uploader;
+
+    static GLenum formatOf(int channels)
+    {
+        return channels == 1 ? GL_RED : channels == 4 ? GL_RGBA : GL_RGB;
+    }
+
+    // the whole mip chain from a w x h base; drivers pad RGB texels to four bytes
+    static size_t chainBytes(int w, int h, int channels)
+    {
+        size_t texel = channels == 3 ? 4 : (size_t)channels;
+        size_t total = 0;
+        for (;;)
+        {
+            total += (size_t)w * h * texel;
+            if (w == 1 && h == 1)
+                return total;
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+    }
+
+    // Makes level 1 the new level 0 and regenerates the chain below it, all on the
+    // GPU: level 1 is blitted into a temporary texture, level 0 is reallocated at
+    // that size and the copy is blitted back, so the texture keeps its name and
+    // nothing is read back to the CPU. False once the texture is down to a single texel.
+    bool dropTopLevel(Entry& entry)
+    {
+        int w = std::max(1, entry.width >> entry.dropped), h = std::max(1, entry.height >> entry.dropped);
+        if (w == 1 && h == 1)
+            return false;
+        int nextW = std::max(1, w / 2), nextH = std::max(1, h / 2);
+        GLenum format = formatOf(entry.channels);
+        if (copyFBOs[0] == 0)
+            glGenFramebuffers(2, copyFBOs);
+        GLint readFBO = 0, drawFBO = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+
+        unsigned int copy;
+        glGenTextures(1, &copy);
+        glBindTexture(GL_TEXTURE_2D, copy);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, nextW, nextH, 0, format, GL_UNSIGNED_BYTE, NULL);
+        blitLevel(entry.texture, 1, copy, nextW, nextH);
+
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, nextW, nextH, 0, format, GL_UNSIGNED_BYTE, NULL);
+        blitLevel(copy, 0, entry.texture, nextW, nextH);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glDeleteTextures(1, &copy);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+
+        size_t bytes = chainBytes(nextW, nextH, entry.channels);
+        residentBytes -= entry.bytes - bytes;
+        entry.bytes = bytes;
+        ++entry.dropped;
+        entry.droppedAt = frame;
+        ++mipsDropped;
+        return true;
+    }
+
+    // copies a w x h mip level of one 2D texture into level 0 of another
+    void blitLevel(unsigned int source, int level, unsigned int target, int w, int h)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFBOs[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, level);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFBOs[1]);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    }
+};
+
+inline TextureCache& textureCache()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// GL work issued since the last reset, bumped at the draw and bind call sites
+// like ShaderProgram::uniformCalls(); main() reads and clears it once a frame
+struct RenderStats
+{
+    uint64_t drawCalls;
+    uint64_t triangles;
+    uint64_t textureBinds;
+};
+
+inline RenderStats& renderStats()
+{
+    static RenderStats stats = { 0, 0, 0 };
+    return stats;
+}
+
+// operator new calls since the last reset; main.cpp replaces the global operator new to count them
+inline std::atomic<uint64_t>& heapAllocations()
+{
+    static std::atomic<uint64_t> count(0);
+    return count;
+}
+
+// bytes asked for by those calls
+inline std::atomic<uint64_t>& heapAllocatedBytes()
+{
+    static std::atomic<uint64_t> bytes(0);
+    return bytes;
+}
+
+// Records nested CPU scopes, GPU timestamp pairs for the same scopes and
+// per-frame counters, and writes them as a Chrome trace ("Trace Event Format"
+// JSON) that chrome://tracing and ui.perfetto.dev open. Scopes are opened and
+// closed from the render thread only. While disabled every call returns after
+// one branch and nothing is allocated or queried.
+class FrameTracer
+{
+public:
+    static const int QUERY_RING = 4; // frames a GPU timestamp may stay in flight before it is read
+
+    bool enabled;
+
+    FrameTracer() : enabled(false), frame(-1), gpuOffsetUs(0.0) {}
+
+    // starts recording; the file is written by finish()
+    void start(const std::string& outputPath)
+    {
+        path = outputPath;
+        enabled = true;
+        origin = Clock::now();
+        events.reserve(1 << 16);
+    }
+
+    void beginFrame()
+    {
+        if (!enabled)
+            return;
+        if (frame < 0)
+            calibrate();
+        ++frame;
+        // the slot's timestamps were issued QUERY_RING frames ago and are normally ready by now
+        GpuSlot& slot = gpuSlots[frame % QUERY_RING];
+        collect(slot);
+        begin("frame");
+    }
+
+    void endFrame()
+    {
+        if (!enabled)
+            return;
+        end();
+    }
+
+    // opens a scope; gpu also brackets it with GL_TIMESTAMP queries
+    void begin(const char* name, bool gpu = true)
+    {
+        if (!enabled)
+            return;
+        OpenScope scope;
+        scope.name = name;
+        scope.start = nowUs();
+        scope.query = gpu ? queryTimestamp() : -1;
+        open.push_back(scope);
+    }
+
+    // closes the innermost open scope
+    void end()
+    {
+        if (!enabled || open.empty())
+            return;
+        const OpenScope& scope = open.back();
+        double now = nowUs();
+        events.push_back({ scope.name, 'X', TRACK_CPU, scope.start, now - scope.start });
+        if (scope.query >= 0)
+        {
+            GpuSlot& slot = gpuSlots[frame % QUERY_RING];
+            slot.pending.push_back({ scope.name, scope.query, queryTimestamp() });
+        }
+        open.pop_back();
+    }
+
+    // one sample of a named counter track at the current time
+    void counter(const char* name, double value)
+    {
+        if (!enabled)
+            return;
+        events.push_back({ name, 'C', TRACK_CPU, nowUs(), value });
+    }
+
+    // reads back the remaining timestamps and writes the trace; false if the file could not be written
+    bool finish()
+    {
+        if (!enabled)
+            return true;
+        while (!open.empty())
+            end();
+        for (GpuSlot& slot : gpuSlots)
+            collect(slot);
+        enabled = false;
+
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"CPU render thread\"}},\n", TRACK_CPU);
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", TRACK_GPU);
+        for (const Event& event : events)
+        {
+            if (event.phase == 'C')
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+                        event.name, event.track, event.timestamp, event.value);
+            else
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, event.track, event.timestamp, event.value);
+        }
+        fprintf(file, "\n]}\n");
+        bool ok = ferror(file) == 0;
+        fclose(file);
+        std::printf("trace: %zu events written to %s\n", events.size(), path.c_str());
+        return ok;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    enum { TRACK_CPU = 1, TRACK_GPU = 2 };
+
+    struct Event
+    {
+        const char* name; // string literals only, so recording never copies
+        char phase; // 'X' complete scope, 'C' counter sample
+        int track;
+        double timestamp; // microseconds since start()
+        double value; // duration for scopes
+    };
+
+    struct OpenScope
+    {
+        const char* name;
+        double start;
+        int query; // index of the begin timestamp in the frame's slot, -1 for CPU-only scopes
+    };
+
+    struct GpuScope
+    {
+        const char* name;
+        int begin, end; // query indices in the slot
+    };
+
+    // the timestamp queries of one frame in the ring, reused every QUERY_RING frames
+    struct GpuSlot
+    {
+        std::vector<unsigned int> queries;
+        unsigned int used = 0;
+        std::vector<GpuScope> pending;
+    };
+
+    std::string path;
+    Clock::time_point origin;
+    std::vector<Event> events;
+    std::vector<OpenScope> open;
+    GpuSlot gpuSlots[QUERY_RING];
+    int frame;
+    double gpuOffsetUs; // add to a GPU timestamp in microseconds to land on the CPU timeline
+
+    double nowUs() const { return std::chrono::duration<double, std::micro>(Clock::now() - origin).count(); }
+
+    // GL_TIMESTAMP and steady_clock run on different origins; line them up once
+    void calibrate()
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuOffsetUs = nowUs() - gpuNow / 1000.0;
+    }
+
+    int queryTimestamp()
+    {
+        GpuSlot& slot = gpuSlots[frame % QUERY_RING];
+        if (slot.used == slot.queries.size())
+        {
+            slot.queries.resize(slot.queries.size() + 16);
+            glGenQueries(16, &slot.queries[slot.used]);
+        }
+        glQueryCounter(slot.queries[slot.used], GL_TIMESTAMP);
+        return (int)slot.used++;
+    }
+
+    void collect(GpuSlot& slot)
+    {
+        for (const GpuScope& scope : slot.pending)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(slot.queries[scope.begin], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(slot.queries[scope.end], GL_QUERY_RESULT, &end);
+            events.push_back({ scope.name, 'X', TRACK_GPU, begin / 1000.0 + gpuOffsetUs, (end - begin) / 1000.0 });
+        }
+        slot.pending.clear();
+        slot.used = 0;
+    }
+};
+
+// one tracer scope for the lifetime of the object, for functions with several returns
+class TraceScope
+{
+public:
+    TraceScope(FrameTracer& tracer, const char* name, bool gpu = true) : tracer(tracer) { tracer.begin(name, gpu); }
+    ~TraceScope() { tracer.end(); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    FrameTracer& tracer;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader_program.h"
+
+// binding points of the shared uniform blocks, the same in every program
+enum UniformBlockBinding { FRAME_BLOCK_BINDING = 0, LIGHT_BLOCK_BINDING = 1, ATLAS_BLOCK_BINDING = 2 };
+
+// floodlights that can hold shadow atlas tiles at once; the GLSL ShadowAtlas blocks size their arrays from it
+const unsigned int MAX_SHADOWED_LIGHTS = 10;
+
+// std140 mirror of `uniform Frame` (camera state, written once per frame)
+struct FrameBlock
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    float padding0;
+};
+
+// std140 mirror of `uniform Light` (the point light and its shadow settings)
+struct LightBlock
+{
+    glm::mat4 shadowMatrices[6]; // light projection * view per cubemap face
+    glm::vec3 lightPos;
+    float far_plane;           // packs into lightPos' vec4 slot
+    glm::vec3 lightStrength;
+    int shadows;               // GLSL bool
+    int shadowFilter;
+    float esmExponent;
+    int shadowSamples;         // PCF taps, 1..20
+    float padding0;
+};
+
+// std140 mirror of `uniform ShadowAtlas` (the floodlights given tiles in the shadow atlas)
+struct AtlasBlock
+{
+    glm::mat4 faceMatrices[MAX_SHADOWED_LIGHTS * 6]; // light projection * view, six faces per slot
+    glm::vec4 lights[MAX_SHADOWED_LIGHTS];           // position, radius (the far plane of its faces)
+};
+
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock must match the std140 layout");
+static_assert(sizeof(LightBlock) == 432, "LightBlock must match the std140 layout");
+static_assert(sizeof(AtlasBlock) == 4000, "AtlasBlock must match the std140 layout");
+
+// One std140 block in a buffer bound to a fixed binding point. update() orphans
+// and rewrites the whole block, so a frame never waits on the previous one.
+template <typename Block>
+class UniformBlock
+{
+public:
+    Block data;
+
+    explicit UniformBlock(unsigned int binding) : binding(binding)
+    {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    }
+
+    void update()
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        ++uploads;
+    }
+
+    // buffer uploads since the last call
+    unsigned int takeUploads()
+    {
+        unsigned int n = uploads;
+        uploads = 0;
+        return n;
+    }
+
+private:
+    unsigned int ubo;
+    unsigned int binding;
+    unsigned int uploads = 0;
+};
+
+// points the program's Frame/Light/ShadowAtlas blocks (whichever it declares) at the shared bindings;
+// GL 3.3 has no layout(binding = N) so this is done once per program on the CPU
+inline void bindUniformBlocks(const ShaderProgram& program)
+{
+    unsigned int frame = glGetUniformBlockIndex(program.ID, "Frame");
+    if (frame != GL_INVALID_INDEX)
+        glUniformBlockBinding(program.ID, frame, FRAME_BLOCK_BINDING);
+    unsigned int light = glGetUniformBlockIndex(program.ID, "Light");
+    if (light != GL_INVALID_INDEX)
+        glUniformBlockBinding(program.ID, light, LIGHT_BLOCK_BINDING);
+    unsigned int atlas = glGetUniformBlockIndex(program.ID, "ShadowAtlas");
+    if (atlas != GL_INVALID_INDEX)
+        glUniformBlockBinding(program.ID, atlas, ATLAS_BLOCK_BINDING);
+}
+
+#endif
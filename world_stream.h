@@ -0,0 +1,300 @@
+#ifndef WORLD_STREAM_H
+#define WORLD_STREAM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "asset_loader.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one object of a tile: model, position, turn about +Y in degrees and scale
+struct TilePlacement
+{
+    unsigned int model;
+    glm::vec3 position;
+    float yaw;
+    glm::vec3 scale;
+};
+
+// Streams the track in square tiles around the camera. The index file names the
+// tile size and every tile with its grid cell and a file of placements:
+//
+//   tile-size 36
+//   tile 0 -1 tile_0_-1.txt
+//
+// and each tile file lists one placement per line, "road 0 0 -8 0 150 100 150"
+// for model, x y z, yaw, scale x y z. '#' starts a comment in both.
+//
+// Tiles whose cell comes within loadRadius of the camera (in the XZ plane) are
+// read and parsed on a worker thread, then added to the scene table on the
+// context thread; tiles are dropped again once they are beyond unloadRadius, so a
+// camera sitting on a boundary does not load and unload the same tile every frame.
+// At most maxResident tiles are loaded or loading at once, nearest first, which
+// bounds the streamed part of the scene whatever the length of the circuit.
+// The streamer owns the tail of the scene table: streamed entities are removed
+// by moving the last entity into their slot, so nothing may be added after them.
+class WorldStreamer
+{
+public:
+    float loadRadius, unloadRadius;
+    unsigned int maxResident;
+
+    // totals over the run
+    unsigned int loads, unloads, cancelled;
+    double latencySumMs, latencyMaxMs; // request to entities in the scene
+
+    WorldStreamer()
+        : loadRadius(60.0f), unloadRadius(80.0f), maxResident(16), loads(0), unloads(0), cancelled(0),
+          latencySumMs(0.0), latencyMaxMs(0.0), tileSize(0.0f), pool(1) {}
+
+    // Reads the index; modelIds maps the names used in the tile files to model ids.
+    // False if the index is missing or has no tiles.
+    bool open(const std::string& indexPath, const std::map<std::string, unsigned int>& modelIds)
+    {
+        std::ifstream file(indexPath);
+        if (!file)
+            return false;
+        ids = modelIds;
+        std::string directory = indexPath.substr(0, indexPath.find_last_of("/\\") + 1);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string keyword;
+            if (!(words >> keyword))
+                continue;
+            if (keyword == "tile-size")
+                words >> tileSize;
+            else if (keyword == "tile")
+            {
+                Tile tile;
+                std::string path;
+                if (words >> tile.x >> tile.z >> path)
+                {
+                    tile.path = directory + path;
+                    tiles.push_back(tile);
+                }
+            }
+        }
+        return tileSize > 0.0f && !tiles.empty();
+    }
+
+    bool active() const { return !tiles.empty(); }
+    unsigned int tileCount() const { return (unsigned int)tiles.size(); }
+
+    unsigned int resident() const
+    {
+        unsigned int count = 0;
+        for (const Tile& tile : tiles)
+            count += tile.state == TILE_RESIDENT ? 1 : 0;
+        return count;
+    }
+
+    unsigned int loading() const
+    {
+        unsigned int count = 0;
+        for (const Tile& tile : tiles)
+            count += tile.state == TILE_LOADING ? 1 : 0;
+        return count;
+    }
+
+    double averageLatencyMs() const { return loads > 0 ? latencySumMs / loads : 0.0; }
+
+    // Requests and drops tiles for a camera at eye, and moves finished tiles into
+    // the scene. blocking waits for this frame's requests, so runs that must render
+    // the same frames every time (benchmarks, recordings, replays) never see a tile
+    // late. Returns true when entities were added or removed.
+    bool update(glm::vec3 eye, SceneTable& scene, bool blocking)
+    {
+        bool changed = false;
+        for (unsigned int t = 0; t < tiles.size(); ++t)
+            if (tiles[t].state == TILE_RESIDENT && distance(tiles[t], eye) > unloadRadius)
+            {
+                unload(t, scene);
+                changed = true;
+            }
+
+        // nearest wanted tiles first, up to the cap
+        unsigned int live = resident() + loading();
+        wanted.clear();
+        for (unsigned int t = 0; t < tiles.size(); ++t)
+            if (tiles[t].state == TILE_UNLOADED && distance(tiles[t], eye) < loadRadius)
+                wanted.push_back(t);
+        std::sort(wanted.begin(), wanted.end(), [&](unsigned int a, unsigned int b) { return distance(tiles[a], eye) < distance(tiles[b], eye); });
+        for (unsigned int t : wanted)
+        {
+            if (live >= maxResident)
+                break;
+            request(t);
+            ++live;
+        }
+
+        do
+            changed = finish(eye, scene, blocking) || changed;
+        while (blocking && loading() > 0);
+        return changed;
+    }
+
+private:
+    enum TileState { TILE_UNLOADED, TILE_LOADING, TILE_RESIDENT };
+    typedef std::chrono::steady_clock Clock;
+
+    struct Tile
+    {
+        int x, z;
+        std::string path;
+        TileState state;
+        Clock::time_point requested;
+        std::vector<unsigned int> entities;
+
+        Tile() : x(0), z(0), state(TILE_UNLOADED) {}
+    };
+
+    // a tile file parsed on the worker
+    struct LoadedTile
+    {
+        unsigned int tile;
+        std::vector<TilePlacement> placements;
+    };
+
+    float tileSize;
+    std::vector<Tile> tiles;
+    std::map<std::string, unsigned int> ids;
+    std::vector<unsigned int> wanted;
+    std::vector<std::pair<unsigned int, unsigned int>> owners; // tile and slot of each streamed entity, by entity id
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<LoadedTile> finished;
+    ThreadPool pool; // last, so the worker is joined before the queue goes away
+
+    // from eye to the nearest point of the tile's cell, in the XZ plane
+    float distance(const Tile& tile, glm::vec3 eye) const
+    {
+        float x0 = tile.x * tileSize, z0 = tile.z * tileSize;
+        float dx = std::max(std::max(x0 - eye.x, eye.x - (x0 + tileSize)), 0.0f);
+        float dz = std::max(std::max(z0 - eye.z, eye.z - (z0 + tileSize)), 0.0f);
+        return std::sqrt(dx * dx + dz * dz);
+    }
+
+    void request(unsigned int t)
+    {
+        tiles[t].state = TILE_LOADING;
+        tiles[t].requested = Clock::now();
+        std::string path = tiles[t].path;
+        pool.submit([this, t, path] {
+            LoadedTile loaded;
+            loaded.tile = t;
+            parse(path, loaded.placements);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(std::move(loaded));
+            }
+            arrived.notify_all();
+        });
+    }
+
+    // worker thread: the placements of one tile file, skipping unknown models
+    void parse(const std::string& path, std::vector<TilePlacement>& placements) const
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "Failed to load tile: " << path << std::endl;
+            return;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string name;
+            TilePlacement placement;
+            if (!(words >> name >> placement.position.x >> placement.position.y >> placement.position.z >> placement.yaw
+                        >> placement.scale.x >> placement.scale.y >> placement.scale.z))
+                continue;
+            std::map<std::string, unsigned int>::const_iterator it = ids.find(name);
+            if (it == ids.end())
+                continue;
+            placement.model = it->second;
+            placements.push_back(placement);
+        }
+    }
+
+    // adds whatever the worker has parsed; if blocking, first waits until something is.
+    // The local queue is only made when there is something in it, since even an
+    // empty deque allocates, and most frames have nothing to add.
+    bool finish(glm::vec3 eye, SceneTable& scene, bool blocking)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (blocking && loading() > 0)
+            arrived.wait(lock, [this] { return !finished.empty(); });
+        if (finished.empty())
+            return false;
+        std::deque<LoadedTile> ready;
+        ready.swap(finished);
+        lock.unlock();
+        bool changed = false;
+        for (LoadedTile& loaded : ready)
+        {
+            Tile& tile = tiles[loaded.tile];
+            // the camera left while it was loading
+            if (distance(tile, eye) > unloadRadius)
+            {
+                tile.state = TILE_UNLOADED;
+                ++cancelled;
+                continue;
+            }
+            for (const TilePlacement& placement : loaded.placements)
+            {
+                unsigned int entity = scene.add(placement.model, placement.position,
+                                                glm::angleAxis(glm::radians(placement.yaw), glm::vec3(0.0f, 1.0f, 0.0f)), placement.scale);
+                if (owners.size() <= entity)
+                    owners.resize(entity + 1, std::make_pair(~0u, ~0u));
+                owners[entity] = std::make_pair(loaded.tile, (unsigned int)tile.entities.size());
+                tile.entities.push_back(entity);
+            }
+            tile.state = TILE_RESIDENT;
+            double latency = std::chrono::duration<double, std::milli>(Clock::now() - tile.requested).count();
+            latencySumMs += latency;
+            latencyMaxMs = std::max(latencyMaxMs, latency);
+            ++loads;
+            changed = true;
+        }
+        return changed;
+    }
+
+    void unload(unsigned int t, SceneTable& scene)
+    {
+        Tile& tile = tiles[t];
+        while (!tile.entities.empty())
+        {
+            unsigned int id = tile.entities.back();
+            tile.entities.pop_back();
+            unsigned int moved = scene.remove(id);
+            if (moved != id)
+            {
+                // the last entity took the freed slot; it is streamed too, so tell its tile
+                owners[id] = owners[moved];
+                tiles[owners[id].first].entities[owners[id].second] = id;
+            }
+            if (owners.size() > scene.size())
+                owners.resize(scene.size());
+        }
+        tile.state = TILE_UNLOADED;
+        ++unloads;
+    }
+};
+
+#endif